@@ -0,0 +1,696 @@
+#include "analysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Direct effects of one function body, before its callees are considered
+struct BodyEffects {
+    bool prints = false;
+    std::set<std::string> globals_read;
+    std::set<std::string> globals_written;
+    std::set<std::string> callees;
+};
+
+static void collect_function_defs(ASTNode *node, std::map<std::string, ASTNode*> &defs) {
+    if (!node) return;
+
+    if (node->type == ASTNodeType::AST_FUNCTION_DEF) {
+        defs[node->data.function_def.name] = node;
+    } else if (node->type == ASTNodeType::AST_SEQUENCE) {
+        collect_function_defs(node->data.sequence.first, defs);
+        collect_function_defs(node->data.sequence.second, defs);
+    }
+}
+
+// Names that are globals refer to the global everywhere, even where a
+// parameter has the same name, as in codegen
+static void scan_body(ASTNode *node, const std::set<std::string> &globals, BodyEffects &effects) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_VARIABLE:
+            if (globals.count(node->data.variable)) {
+                effects.globals_read.insert(node->data.variable);
+            }
+            break;
+        case ASTNodeType::AST_BINARY_OP:
+            scan_body(node->data.binary.left, globals, effects);
+            scan_body(node->data.binary.right, globals, effects);
+            break;
+        case ASTNodeType::AST_CONDITIONAL:
+            scan_body(node->data.conditional.condition, globals, effects);
+            scan_body(node->data.conditional.then_value, globals, effects);
+            scan_body(node->data.conditional.else_value, globals, effects);
+            break;
+        case ASTNodeType::AST_ASSIGNMENT:
+            if (globals.count(node->data.assignment.name)) {
+                effects.globals_written.insert(node->data.assignment.name);
+            }
+            scan_body(node->data.assignment.value, globals, effects);
+            break;
+        case ASTNodeType::AST_RETURN:
+            scan_body(node->data.return_value, globals, effects);
+            break;
+        case ASTNodeType::AST_SEQUENCE:
+            scan_body(node->data.sequence.first, globals, effects);
+            scan_body(node->data.sequence.second, globals, effects);
+            break;
+        case ASTNodeType::AST_WHILE:
+            scan_body(node->data.while_loop.condition, globals, effects);
+            scan_body(node->data.while_loop.body, globals, effects);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            scan_body(node->data.for_loop.init, globals, effects);
+            scan_body(node->data.for_loop.condition, globals, effects);
+            scan_body(node->data.for_loop.increment, globals, effects);
+            scan_body(node->data.for_loop.body, globals, effects);
+            break;
+        case ASTNodeType::AST_IF:
+            scan_body(node->data.if_stmt.condition, globals, effects);
+            scan_body(node->data.if_stmt.then_branch, globals, effects);
+            scan_body(node->data.if_stmt.else_branch, globals, effects);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            scan_body(node->data.switch_stmt.value, globals, effects);
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                scan_body(arm->body, globals, effects);
+            }
+            break;
+        case ASTNodeType::AST_PRINT:
+            effects.prints = true;
+            scan_body(node->data.print_value, globals, effects);
+            break;
+        case ASTNodeType::AST_FUNCTION_CALL:
+            effects.callees.insert(node->data.function_call.name);
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                scan_body(arg->expr, globals, effects);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static bool reaches(const std::map<std::string, FunctionInfo> &functions,
+                    const std::string &from, const std::string &target,
+                    std::set<std::string> &visited) {
+    auto info = functions.find(from);
+    if (info == functions.end()) return false;
+
+    for (const auto &callee : info->second.callees) {
+        if (callee == target) return true;
+        if (visited.insert(callee).second && reaches(functions, callee, target, visited)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::map<std::string, FunctionInfo> analyze_functions(ASTNode *root, GlobalVar *globals) {
+    std::set<std::string> global_names;
+    for (GlobalVar *global = globals; global; global = global->next) {
+        global_names.insert(global->name);
+    }
+
+    std::map<std::string, ASTNode*> defs;
+    collect_function_defs(root, defs);
+
+    std::map<std::string, BodyEffects> effects;
+    std::set<std::string> written_anywhere;
+    for (const auto &[name, def] : defs) {
+        scan_body(def->data.function_def.body, global_names, effects[name]);
+        written_anywhere.insert(effects[name].globals_written.begin(),
+                                effects[name].globals_written.end());
+    }
+
+    // Start from each body's own effects...
+    std::map<std::string, FunctionInfo> functions;
+    for (const auto &[name, def] : defs) {
+        const BodyEffects &body = effects[name];
+        FunctionInfo &info = functions[name];
+        info.def = def;
+        info.param_count = param_list_count(def->data.function_def.params);
+        info.callees = body.callees;
+        info.globals_read = body.globals_read;
+        info.globals_written = body.globals_written;
+        info.recursive = false;
+        info.pure = true;
+
+        if (body.prints) {
+            info.pure = false;
+            info.impure_reason = "calls print";
+        } else if (!body.globals_written.empty()) {
+            info.pure = false;
+            info.impure_reason = "writes global " + *body.globals_written.begin();
+        } else {
+            for (const auto &global : body.globals_read) {
+                if (written_anywhere.count(global)) {
+                    info.pure = false;
+                    info.impure_reason = "reads mutable global " + global;
+                    break;
+                }
+            }
+        }
+    }
+
+    // ...then propagate impurity to callers until nothing changes. Starting
+    // optimistic makes recursive functions pure unless something in their
+    // cycle is not.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &[name, info] : functions) {
+            if (!info.pure) continue;
+            for (const auto &callee : info.callees) {
+                auto callee_info = functions.find(callee);
+                if (callee_info == functions.end()) {
+                    info.pure = false;
+                    info.impure_reason = "calls unknown function " + callee;
+                } else if (!callee_info->second.pure) {
+                    info.pure = false;
+                    info.impure_reason = "calls impure function " + callee;
+                }
+                if (!info.pure) {
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (auto &[name, info] : functions) {
+        std::set<std::string> visited;
+        info.recursive = reaches(functions, name, name, visited);
+    }
+
+    return functions;
+}
+
+std::set<std::string> reachable_functions(const std::map<std::string, FunctionInfo> &functions,
+                                          const std::set<std::string> &roots) {
+    std::set<std::string> reachable;
+    std::vector<std::string> pending(roots.begin(), roots.end());
+    while (!pending.empty()) {
+        std::string name = pending.back();
+        pending.pop_back();
+
+        auto info = functions.find(name);
+        if (info == functions.end() || !reachable.insert(name).second) continue;
+        pending.insert(pending.end(), info->second.callees.begin(), info->second.callees.end());
+    }
+    return reachable;
+}
+
+static void flatten_statements(ASTNode *node, std::vector<ASTNode*> &statements) {
+    if (!node) return;
+
+    if (node->type == ASTNodeType::AST_SEQUENCE) {
+        flatten_statements(node->data.sequence.first, statements);
+        flatten_statements(node->data.sequence.second, statements);
+    } else {
+        statements.push_back(node);
+    }
+}
+
+static bool mentions(ASTNode *node, const std::string &global) {
+    BodyEffects effects;
+    scan_body(node, {global}, effects);
+    return !effects.globals_read.empty() || !effects.globals_written.empty();
+}
+
+// True if every call assigns the global before anything can read it: the
+// first top-level statement that mentions it assigns it, from a value
+// that does not read it
+static bool assigned_before_use(ASTNode *body, const std::string &global) {
+    std::vector<ASTNode*> statements;
+    flatten_statements(body, statements);
+
+    for (ASTNode *statement : statements) {
+        if (statement->type == ASTNodeType::AST_ASSIGNMENT &&
+            global == statement->data.assignment.name) {
+            return !mentions(statement->data.assignment.value, global);
+        }
+        if (mentions(statement, global)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+std::map<std::string, GlobalInfo> analyze_globals(GlobalVar *globals,
+                                                  const std::map<std::string, FunctionInfo> &functions) {
+    std::map<std::string, GlobalInfo> result;
+    for (GlobalVar *global = globals; global; global = global->next) {
+        result[global->name].read_only = true;
+    }
+
+    bool main_is_called = false;
+    for (const auto &[name, info] : functions) {
+        main_is_called = main_is_called || info.callees.count("main");
+        for (const auto &global : info.globals_read) {
+            result[global].users.insert(name);
+        }
+        for (const auto &global : info.globals_written) {
+            result[global].users.insert(name);
+            result[global].read_only = false;
+        }
+    }
+
+    // Read-only globals are better off as constants than as locals
+    for (auto &[name, global] : result) {
+        if (global.read_only || global.users.size() != 1) continue;
+
+        const std::string &user = *global.users.begin();
+        const FunctionInfo &info = functions.at(user);
+        if (info.recursive) {
+            global.shared_reason = user + " is recursive";
+        } else if ((user == "main" && !main_is_called) ||
+                   assigned_before_use(info.def->data.function_def.body, name)) {
+            global.owner = user;
+        } else {
+            global.shared_reason = user + " can read the value of an earlier call";
+        }
+    }
+    return result;
+}
+
+// A global that the function assigns, directly or through its callees
+static std::string assigned_global(const std::map<std::string, FunctionInfo> &functions,
+                                   const std::string &name, std::set<std::string> &visited) {
+    auto info = functions.find(name);
+    if (info == functions.end()) return "";
+    if (!info->second.globals_written.empty()) {
+        return *info->second.globals_written.begin();
+    }
+    for (const auto &callee : info->second.callees) {
+        if (!visited.insert(callee).second) continue;
+        std::string global = assigned_global(functions, callee, visited);
+        if (!global.empty()) return global;
+    }
+    return "";
+}
+
+namespace {
+
+// Checks one parallel for. Its iterations run concurrently, so they may
+// only share state that nothing in the loop assigns, apart from the
+// reduction variables, which each thread accumulates separately.
+struct ParallelLoopChecker {
+    const std::map<std::string, FunctionInfo> &functions;
+    const std::set<std::string> &globals;
+    std::string loop_variable;
+    std::map<std::string, BinaryOp> reductions;
+    std::set<std::string> &callees;
+    std::string error;
+
+    void fail(const std::string &reason) {
+        if (error.empty()) error = reason;
+    }
+
+    bool is_reduction_update(ASTNode *node, const std::string &name);
+    void check_header(ASTNode *loop);
+    void check_loop(ASTNode *loop);
+    void check_body(ASTNode *node);
+};
+
+} // namespace
+
+static const char *reduction_op_text(BinaryOp op) {
+    return op == BinaryOp::OP_MUL ? "*" : "+";
+}
+
+// name = name op value, or name = value op name
+bool ParallelLoopChecker::is_reduction_update(ASTNode *node, const std::string &name) {
+    ASTNode *value = node->data.assignment.value;
+    if (value->type != ASTNodeType::AST_BINARY_OP || value->data.binary.op != reductions[name]) {
+        return false;
+    }
+
+    ASTNode *left = value->data.binary.left;
+    ASTNode *right = value->data.binary.right;
+    ASTNode *other;
+    if (left->type == ASTNodeType::AST_VARIABLE && name == left->data.variable) {
+        other = right;
+    } else if (right->type == ASTNodeType::AST_VARIABLE && name == right->data.variable) {
+        other = left;
+    } else {
+        return false;
+    }
+    if (mentions(other, name)) {
+        return false;
+    }
+    check_body(other);
+    return true;
+}
+
+// The loop variable, condition, increment and reductions, which code
+// generation relies on
+void ParallelLoopChecker::check_header(ASTNode *loop) {
+    ASTNode *condition = loop->data.for_loop.condition;
+    ASTNode *increment = loop->data.for_loop.increment->data.assignment.value;
+    loop_variable = loop->data.for_loop.init->data.assignment.name;
+
+    if (globals.count(loop_variable)) {
+        fail("the loop variable " + loop_variable + " is a global");
+    }
+    if (condition->type != ASTNodeType::AST_BINARY_OP ||
+        (condition->data.binary.op != BinaryOp::OP_LT &&
+         condition->data.binary.op != BinaryOp::OP_LE) ||
+        condition->data.binary.left->type != ASTNodeType::AST_VARIABLE ||
+        loop_variable != condition->data.binary.left->data.variable ||
+        mentions(condition->data.binary.right, loop_variable)) {
+        fail("the condition must be " + loop_variable + " < bound or " + loop_variable +
+             " <= bound, with a bound that does not use " + loop_variable);
+    }
+    if (loop_variable != loop->data.for_loop.increment->data.assignment.name ||
+        increment->type != ASTNodeType::AST_BINARY_OP ||
+        increment->data.binary.op != BinaryOp::OP_ADD ||
+        increment->data.binary.left->type != ASTNodeType::AST_VARIABLE ||
+        loop_variable != increment->data.binary.left->data.variable ||
+        increment->data.binary.right->type != ASTNodeType::AST_NUMBER ||
+        increment->data.binary.right->data.number <= 0) {
+        fail("the increment must be " + loop_variable + " = " + loop_variable +
+             " + a positive constant");
+    }
+
+    for (ReductionList *r = loop->data.for_loop.reductions; r; r = r->next) {
+        if (globals.count(r->name)) {
+            fail(std::string("the reduction variable ") + r->name + " is a global");
+        } else if (loop_variable == r->name) {
+            fail(std::string("the loop variable ") + r->name + " cannot be a reduction variable");
+        } else if (!reductions.emplace(r->name, r->op).second) {
+            fail(std::string("the reduction variable ") + r->name + " is listed twice");
+        }
+    }
+}
+
+void ParallelLoopChecker::check_loop(ASTNode *loop) {
+    check_header(loop);
+    check_body(loop->data.for_loop.body);
+}
+
+void ParallelLoopChecker::check_body(ASTNode *node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_VARIABLE:
+            if (reductions.count(node->data.variable)) {
+                std::string name = node->data.variable;
+                fail("the reduction variable " + name + " can only be updated, as " + name +
+                     " = " + name + " " + reduction_op_text(reductions[name]) + " ...");
+            }
+            break;
+        case ASTNodeType::AST_BINARY_OP:
+            check_body(node->data.binary.left);
+            check_body(node->data.binary.right);
+            break;
+        case ASTNodeType::AST_CONDITIONAL:
+            check_body(node->data.conditional.condition);
+            check_body(node->data.conditional.then_value);
+            check_body(node->data.conditional.else_value);
+            break;
+        case ASTNodeType::AST_ASSIGNMENT: {
+            std::string name = node->data.assignment.name;
+            if (name == loop_variable) {
+                fail("the body assigns the loop variable " + name);
+            } else if (globals.count(name)) {
+                fail("the body assigns global " + name);
+            } else if (reductions.count(name)) {
+                if (!is_reduction_update(node, name)) {
+                    fail("the reduction variable " + name + " can only be updated, as " + name +
+                         " = " + name + " " + reduction_op_text(reductions[name]) + " ...");
+                }
+                break;
+            }
+            check_body(node->data.assignment.value);
+            break;
+        }
+        case ASTNodeType::AST_RETURN:
+            fail("the body cannot return");
+            break;
+        case ASTNodeType::AST_SEQUENCE:
+            check_body(node->data.sequence.first);
+            check_body(node->data.sequence.second);
+            break;
+        case ASTNodeType::AST_WHILE:
+            check_body(node->data.while_loop.condition);
+            check_body(node->data.while_loop.body);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            check_body(node->data.for_loop.init);
+            check_body(node->data.for_loop.condition);
+            check_body(node->data.for_loop.increment);
+            check_body(node->data.for_loop.body);
+            break;
+        case ASTNodeType::AST_IF:
+            check_body(node->data.if_stmt.condition);
+            check_body(node->data.if_stmt.then_branch);
+            check_body(node->data.if_stmt.else_branch);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            check_body(node->data.switch_stmt.value);
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                check_body(arm->body);
+            }
+            break;
+        case ASTNodeType::AST_PRINT:
+            check_body(node->data.print_value);
+            break;
+        case ASTNodeType::AST_FUNCTION_CALL: {
+            std::string name = node->data.function_call.name;
+            std::set<std::string> visited = {name};
+            std::string global = assigned_global(functions, name, visited);
+            if (!global.empty()) {
+                fail("the body calls " + name + ", which assigns global " + global);
+            }
+            callees.insert(name);
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                check_body(arg->expr);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void find_parallel_loops(ASTNode *node, std::vector<ASTNode*> &loops) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_SEQUENCE:
+            find_parallel_loops(node->data.sequence.first, loops);
+            find_parallel_loops(node->data.sequence.second, loops);
+            break;
+        case ASTNodeType::AST_WHILE:
+            find_parallel_loops(node->data.while_loop.body, loops);
+            break;
+        case ASTNodeType::AST_PARALLEL_FOR:
+            loops.push_back(node);
+            [[fallthrough]];
+        case ASTNodeType::AST_FOR:
+            find_parallel_loops(node->data.for_loop.body, loops);
+            break;
+        case ASTNodeType::AST_IF:
+            find_parallel_loops(node->data.if_stmt.then_branch, loops);
+            find_parallel_loops(node->data.if_stmt.else_branch, loops);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                find_parallel_loops(arm->body, loops);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool has_parallel_loops(ASTNode *def) {
+    std::vector<ASTNode*> loops;
+    find_parallel_loops(def->data.function_def.body, loops);
+    return !loops.empty();
+}
+
+static std::set<std::string> global_name_set(GlobalVar *globals) {
+    std::set<std::string> names;
+    for (GlobalVar *global = globals; global; global = global->next) {
+        names.insert(global->name);
+    }
+    return names;
+}
+
+bool check_parallel_loop_headers(ASTNode *def, GlobalVar *globals,
+                                 std::vector<std::string> &diagnostics) {
+    std::map<std::string, FunctionInfo> no_functions;
+    std::set<std::string> global_names = global_name_set(globals);
+    std::set<std::string> callees;
+    std::vector<ASTNode*> loops;
+    find_parallel_loops(def->data.function_def.body, loops);
+
+    bool ok = true;
+    for (ASTNode *loop : loops) {
+        ParallelLoopChecker checker{no_functions, global_names, "", {}, callees, ""};
+        checker.check_header(loop);
+        if (!checker.error.empty()) {
+            diagnostics.push_back(std::string("Error: parallel for in ") +
+                                  def->data.function_def.name + ": " + checker.error);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+std::set<std::string> check_parallel_loops(const std::map<std::string, FunctionInfo> &functions,
+                                           GlobalVar *globals,
+                                           std::vector<std::string> &diagnostics) {
+    std::set<std::string> global_names = global_name_set(globals);
+
+    std::set<std::string> callees;
+    for (const auto &[name, info] : functions) {
+        if (!info.def) continue;
+        std::vector<ASTNode*> loops;
+        find_parallel_loops(info.def->data.function_def.body, loops);
+        for (ASTNode *loop : loops) {
+            ParallelLoopChecker checker{functions, global_names, "", {}, callees, ""};
+            checker.check_loop(loop);
+            if (!checker.error.empty()) {
+                diagnostics.push_back("Error: parallel for in " + name + ": " + checker.error);
+            }
+        }
+    }
+    return reachable_functions(functions, callees);
+}
+
+// Iterations assumed per loop, and the deepest nesting that multiplies
+static constexpr double ESTIMATED_TRIP_COUNT = 10;
+static constexpr int MAX_COUNTED_DEPTH = 6;
+
+// Loop nesting, size and call sites of one function body
+struct BodyShape {
+    int loop_depth = 0;
+    int size = 0;
+    std::map<std::string, double> calls;   // Callee -> calls per run of the body
+    std::set<std::string> loop_callees;    // Called inside a loop
+};
+
+static void measure_body(ASTNode *node, int depth, BodyShape &shape) {
+    if (!node) return;
+
+    shape.size++;
+    switch (node->type) {
+        case ASTNodeType::AST_BINARY_OP:
+            measure_body(node->data.binary.left, depth, shape);
+            measure_body(node->data.binary.right, depth, shape);
+            break;
+        case ASTNodeType::AST_CONDITIONAL:
+            measure_body(node->data.conditional.condition, depth, shape);
+            measure_body(node->data.conditional.then_value, depth, shape);
+            measure_body(node->data.conditional.else_value, depth, shape);
+            break;
+        case ASTNodeType::AST_ASSIGNMENT:
+            measure_body(node->data.assignment.value, depth, shape);
+            break;
+        case ASTNodeType::AST_RETURN:
+            measure_body(node->data.return_value, depth, shape);
+            break;
+        case ASTNodeType::AST_SEQUENCE:
+            shape.size--;
+            measure_body(node->data.sequence.first, depth, shape);
+            measure_body(node->data.sequence.second, depth, shape);
+            break;
+        case ASTNodeType::AST_WHILE:
+            shape.loop_depth = std::max(shape.loop_depth, depth + 1);
+            measure_body(node->data.while_loop.condition, depth + 1, shape);
+            measure_body(node->data.while_loop.body, depth + 1, shape);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            shape.loop_depth = std::max(shape.loop_depth, depth + 1);
+            measure_body(node->data.for_loop.init, depth, shape);
+            measure_body(node->data.for_loop.condition, depth + 1, shape);
+            measure_body(node->data.for_loop.increment, depth + 1, shape);
+            measure_body(node->data.for_loop.body, depth + 1, shape);
+            break;
+        case ASTNodeType::AST_IF:
+            measure_body(node->data.if_stmt.condition, depth, shape);
+            measure_body(node->data.if_stmt.then_branch, depth, shape);
+            measure_body(node->data.if_stmt.else_branch, depth, shape);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            measure_body(node->data.switch_stmt.value, depth, shape);
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                measure_body(arm->body, depth, shape);
+            }
+            break;
+        case ASTNodeType::AST_PRINT:
+            measure_body(node->data.print_value, depth, shape);
+            break;
+        case ASTNodeType::AST_FUNCTION_CALL:
+            shape.calls[node->data.function_call.name] +=
+                std::pow(ESTIMATED_TRIP_COUNT, std::min(depth, MAX_COUNTED_DEPTH));
+            if (depth > 0) shape.loop_callees.insert(node->data.function_call.name);
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                measure_body(arg->expr, depth, shape);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void postorder(const std::map<std::string, FunctionInfo> &functions,
+                      const std::string &name, std::set<std::string> &visited,
+                      std::vector<std::string> &order) {
+    auto info = functions.find(name);
+    if (info == functions.end() || !visited.insert(name).second) return;
+    for (const auto &callee : info->second.callees) {
+        postorder(functions, callee, visited, order);
+    }
+    order.push_back(name);
+}
+
+std::map<std::string, FunctionProfile> profile_functions(
+    const std::map<std::string, FunctionInfo> &functions, const std::set<std::string> &roots) {
+    std::map<std::string, BodyShape> shapes;
+    std::map<std::string, FunctionProfile> profiles;
+    for (const auto &[name, info] : functions) {
+        measure_body(info.def->data.function_def.body, 0, shapes[name]);
+        profiles[name] = {shapes[name].loop_depth, shapes[name].size, 0, false};
+    }
+
+    // Callers before callees, so that every forward call adds the final
+    // count of its caller; calls back up the call graph only make the
+    // functions in the cycle recursive
+    std::set<std::string> visited;
+    std::vector<std::string> order;
+    for (const auto &root : roots) {
+        postorder(functions, root, visited, order);
+    }
+    std::map<std::string, size_t> position;
+    for (size_t i = 0; i < order.size(); i++) {
+        position[order[i]] = order.size() - 1 - i;
+    }
+    for (const auto &root : roots) {
+        if (profiles.count(root)) profiles[root].calls = 1;
+    }
+
+    for (auto name = order.rbegin(); name != order.rend(); ++name) {
+        FunctionProfile &profile = profiles[*name];
+        if (functions.at(*name).recursive) {
+            profile.calls *= ESTIMATED_TRIP_COUNT;
+        }
+        for (const auto &callee : shapes[*name].loop_callees) {
+            if (profiles.count(callee)) profiles[callee].called_in_loop = true;
+        }
+        for (const auto &[callee, calls] : shapes[*name].calls) {
+            auto callee_position = position.find(callee);
+            if (callee_position != position.end() && callee_position->second > position[*name]) {
+                profiles[callee].calls += profile.calls * calls;
+            }
+        }
+    }
+    return profiles;
+}
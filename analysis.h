@@ -0,0 +1,86 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "ast.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// What the whole-program analysis knows about one function definition
+struct FunctionInfo {
+    ASTNode *def;
+    int param_count;
+    std::set<std::string> callees;   // Functions called directly from the body
+    std::set<std::string> globals_read;      // Directly, by the body
+    std::set<std::string> globals_written;   // Directly, by the body
+    bool recursive;                  // Can reach itself through calls
+
+    // A pure function's result depends only on its arguments, and calling
+    // it has no visible effect: it does not print, does not write globals,
+    // only reads globals that nothing writes, and only calls pure functions
+    bool pure;
+    std::string impure_reason;       // Set when !pure
+};
+
+std::map<std::string, FunctionInfo> analyze_functions(ASTNode *root, GlobalVar *globals);
+
+// Functions that can be called, directly or indirectly, from roots
+// (including the roots that are defined)
+std::set<std::string> reachable_functions(const std::map<std::string, FunctionInfo> &functions,
+                                          const std::set<std::string> &roots);
+
+// Check that the iterations of each parallel for can run concurrently:
+// the loop counts up by a constant step, and the body does not return,
+// assign the loop variable or globals, call functions that assign
+// globals, or use its reduction variables other than to update them.
+// Returns the functions that loop bodies can call, directly or indirectly.
+// Functions without a def (summaries kept by streaming compilation) are
+// only looked at as callees.
+std::set<std::string> check_parallel_loops(const std::map<std::string, FunctionInfo> &functions,
+                                           GlobalVar *globals,
+                                           std::vector<std::string> &diagnostics);
+
+// Only the part of check_parallel_loops that looks at each loop's header
+// (loop variable, condition, increment and reductions) in one function
+// definition, for streaming compilation, which generates the function
+// before the rest of the program is known. Code generation relies on the
+// header's shape, so a function must pass before it is generated.
+bool check_parallel_loop_headers(ASTNode *def, GlobalVar *globals,
+                                 std::vector<std::string> &diagnostics);
+
+// What the AST says about how much optimizing a function can pay off
+struct FunctionProfile {
+    int loop_depth;     // Deepest loop nesting in the body
+    int size;           // AST nodes in the body
+    double calls;       // Estimated calls per run of the program
+    bool called_in_loop;   // From a loop of a reachable caller
+};
+
+// Estimate how often each function runs from the call graph: each root
+// runs once, a call site counts once per call of its caller and ten times
+// per loop around it, and a recursive function ten times over. Functions
+// the roots cannot reach get 0 calls.
+std::map<std::string, FunctionProfile> profile_functions(
+    const std::map<std::string, FunctionInfo> &functions, const std::set<std::string> &roots);
+
+// Whether a function definition has a parallel for in it
+bool has_parallel_loops(ASTNode *def);
+
+// How the program uses one global variable
+struct GlobalInfo {
+    std::set<std::string> users;   // Functions that read or assign it
+    bool read_only;                // No function assigns it
+
+    // Set when the global can be a local variable of this function
+    // instead: it is its only user, and no call of it can see a value
+    // left by an earlier call
+    std::string owner;
+    std::string shared_reason;     // Why not, when there is one user
+};
+
+std::map<std::string, GlobalInfo> analyze_globals(GlobalVar *globals,
+                                                  const std::map<std::string, FunctionInfo> &functions);
+
+#endif /* ANALYSIS_H */
@@ -1,6 +1,11 @@
 #include "ast.h"
 #include <cstdlib>
 #include <cstring>
+#include <utility>
+
+static char *span_dup(Span name) {
+    return strndup(name.start, name.length);
+}
 
 ASTNode* ast_number(int value) {
     ASTNode *node = new ASTNode;
@@ -18,17 +23,26 @@ ASTNode* ast_binary(BinaryOp op, ASTNode *left, ASTNode *right) {
     return node;
 }
 
-ASTNode* ast_variable(char *name) {
+ASTNode* ast_conditional(ASTNode *condition, ASTNode *then_value, ASTNode *else_value) {
+    ASTNode *node = new ASTNode;
+    node->type = ASTNodeType::AST_CONDITIONAL;
+    node->data.conditional.condition = condition;
+    node->data.conditional.then_value = then_value;
+    node->data.conditional.else_value = else_value;
+    return node;
+}
+
+ASTNode* ast_variable(Span name) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_VARIABLE;
-    node->data.variable = strdup(name);
+    node->data.variable = span_dup(name);
     return node;
 }
 
-ASTNode* ast_assignment(char *name, ASTNode *value) {
+ASTNode* ast_assignment(Span name, ASTNode *value) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_ASSIGNMENT;
-    node->data.assignment.name = strdup(name);
+    node->data.assignment.name = span_dup(name);
     node->data.assignment.value = value;
     return node;
 }
@@ -48,11 +62,12 @@ ASTNode* ast_sequence(ASTNode *first, ASTNode *second) {
     return node;
 }
 
-ASTNode* ast_while(ASTNode *condition, ASTNode *body) {
+ASTNode* ast_while(ASTNode *condition, ASTNode *body, BranchHint hint) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_WHILE;
     node->data.while_loop.condition = condition;
     node->data.while_loop.body = body;
+    node->data.while_loop.hint = hint;
     return node;
 }
 
@@ -63,15 +78,34 @@ ASTNode* ast_for(ASTNode *init, ASTNode *condition, ASTNode *increment, ASTNode
     node->data.for_loop.condition = condition;
     node->data.for_loop.increment = increment;
     node->data.for_loop.body = body;
+    node->data.for_loop.reductions = nullptr;
     return node;
 }
 
-ASTNode* ast_if(ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch) {
+ASTNode* ast_parallel_for(ASTNode *init, ASTNode *condition, ASTNode *increment,
+                          ReductionList *reductions, ASTNode *body) {
+    ASTNode *node = ast_for(init, condition, increment, body);
+    node->type = ASTNodeType::AST_PARALLEL_FOR;
+    node->data.for_loop.reductions = reductions;
+    return node;
+}
+
+ASTNode* ast_if(ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch,
+                BranchHint hint) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_IF;
     node->data.if_stmt.condition = condition;
     node->data.if_stmt.then_branch = then_branch;
     node->data.if_stmt.else_branch = else_branch;
+    node->data.if_stmt.hint = hint;
+    return node;
+}
+
+ASTNode* ast_switch(ASTNode *value, SwitchArm *arms) {
+    ASTNode *node = new ASTNode;
+    node->type = ASTNodeType::AST_SWITCH;
+    node->data.switch_stmt.value = value;
+    node->data.switch_stmt.arms = arms;
     return node;
 }
 
@@ -82,33 +116,56 @@ ASTNode* ast_print(ASTNode *value) {
     return node;
 }
 
-ASTNode* ast_function_def(char *name, ParamList *params, ASTNode *body) {
+ASTNode* ast_function_def(Span name, ParamList *params, ASTNode *body, int qualifiers) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_FUNCTION_DEF;
-    node->data.function_def.name = strdup(name);
+    node->data.function_def.name = span_dup(name);
     node->data.function_def.params = params;
     node->data.function_def.body = body;
+    node->data.function_def.qualifiers = qualifiers;
     return node;
 }
 
-ASTNode* ast_function_call(char *name, ArgList *args) {
+ASTNode* ast_function_call(Span name, ArgList *args) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_FUNCTION_CALL;
-    node->data.function_call.name = strdup(name);
+    node->data.function_call.name = span_dup(name);
     node->data.function_call.args = args;
     return node;
 }
 
-ASTNode* ast_global_var(char *name, ASTNode *value) {
+ASTNode* ast_global_var(Span name, ASTNode *value) {
     ASTNode *node = new ASTNode;
     node->type = ASTNodeType::AST_GLOBAL_VAR;
-    node->data.global_var.name = strdup(name);
+    node->data.global_var.name = span_dup(name);
     node->data.global_var.value = value;
     return node;
 }
 
-ParamList* param_list_create(char *name, ParamList *next) {
-    return new ParamList(strdup(name), next);
+const char* ast_node_type_name(ASTNodeType type) {
+    switch (type) {
+        case ASTNodeType::AST_NUMBER: return "AST_NUMBER";
+        case ASTNodeType::AST_BINARY_OP: return "AST_BINARY_OP";
+        case ASTNodeType::AST_CONDITIONAL: return "AST_CONDITIONAL";
+        case ASTNodeType::AST_VARIABLE: return "AST_VARIABLE";
+        case ASTNodeType::AST_ASSIGNMENT: return "AST_ASSIGNMENT";
+        case ASTNodeType::AST_RETURN: return "AST_RETURN";
+        case ASTNodeType::AST_SEQUENCE: return "AST_SEQUENCE";
+        case ASTNodeType::AST_WHILE: return "AST_WHILE";
+        case ASTNodeType::AST_FOR: return "AST_FOR";
+        case ASTNodeType::AST_PARALLEL_FOR: return "AST_PARALLEL_FOR";
+        case ASTNodeType::AST_IF: return "AST_IF";
+        case ASTNodeType::AST_SWITCH: return "AST_SWITCH";
+        case ASTNodeType::AST_PRINT: return "AST_PRINT";
+        case ASTNodeType::AST_FUNCTION_DEF: return "AST_FUNCTION_DEF";
+        case ASTNodeType::AST_FUNCTION_CALL: return "AST_FUNCTION_CALL";
+        case ASTNodeType::AST_GLOBAL_VAR: return "AST_GLOBAL_VAR";
+    }
+    return "AST_UNKNOWN";
+}
+
+ParamList* param_list_create(Span name, ParamList *next) {
+    return new ParamList(span_dup(name), next);
 }
 
 ArgList* arg_list_create(ASTNode *expr, ArgList *next) {
@@ -142,6 +199,28 @@ void param_list_free(ParamList *params) {
     }
 }
 
+ReductionList* reduction_list_create(BinaryOp op, Span name, ReductionList *next) {
+    return new ReductionList(op, span_dup(name), next);
+}
+
+void reduction_list_free(ReductionList *reductions) {
+    while (reductions) {
+        ReductionList *next = reductions->next;
+        free(reductions->name);
+        delete reductions;
+        reductions = next;
+    }
+}
+
+void switch_arms_free(SwitchArm *arms) {
+    while (arms) {
+        SwitchArm *next = arms->next;
+        ast_free(arms->body);
+        delete arms;
+        arms = next;
+    }
+}
+
 void arg_list_free(ArgList *args) {
     while (args) {
         ArgList *next = args->next;
@@ -159,6 +238,11 @@ void ast_free(ASTNode *node) {
             ast_free(node->data.binary.left);
             ast_free(node->data.binary.right);
             break;
+        case ASTNodeType::AST_CONDITIONAL:
+            ast_free(node->data.conditional.condition);
+            ast_free(node->data.conditional.then_value);
+            ast_free(node->data.conditional.else_value);
+            break;
         case ASTNodeType::AST_VARIABLE:
             free(node->data.variable);
             break;
@@ -178,16 +262,22 @@ void ast_free(ASTNode *node) {
             ast_free(node->data.while_loop.body);
             break;
         case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
             ast_free(node->data.for_loop.init);
             ast_free(node->data.for_loop.condition);
             ast_free(node->data.for_loop.increment);
             ast_free(node->data.for_loop.body);
+            reduction_list_free(node->data.for_loop.reductions);
             break;
         case ASTNodeType::AST_IF:
             ast_free(node->data.if_stmt.condition);
             ast_free(node->data.if_stmt.then_branch);
             ast_free(node->data.if_stmt.else_branch);
             break;
+        case ASTNodeType::AST_SWITCH:
+            ast_free(node->data.switch_stmt.value);
+            switch_arms_free(node->data.switch_stmt.arms);
+            break;
         case ASTNodeType::AST_PRINT:
             ast_free(node->data.print_value);
             break;
@@ -211,14 +301,95 @@ void ast_free(ASTNode *node) {
     delete node;
 }
 
-static GlobalVar *global_vars_list = nullptr;
+static void collect_variables(ASTNode *node, std::set<std::string> &names) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_VARIABLE:
+            names.insert(node->data.variable);
+            break;
+        case ASTNodeType::AST_BINARY_OP:
+            collect_variables(node->data.binary.left, names);
+            collect_variables(node->data.binary.right, names);
+            break;
+        case ASTNodeType::AST_CONDITIONAL:
+            collect_variables(node->data.conditional.condition, names);
+            collect_variables(node->data.conditional.then_value, names);
+            collect_variables(node->data.conditional.else_value, names);
+            break;
+        case ASTNodeType::AST_ASSIGNMENT:
+            names.insert(node->data.assignment.name);
+            collect_variables(node->data.assignment.value, names);
+            break;
+        case ASTNodeType::AST_RETURN:
+            collect_variables(node->data.return_value, names);
+            break;
+        case ASTNodeType::AST_SEQUENCE:
+            collect_variables(node->data.sequence.first, names);
+            collect_variables(node->data.sequence.second, names);
+            break;
+        case ASTNodeType::AST_WHILE:
+            collect_variables(node->data.while_loop.condition, names);
+            collect_variables(node->data.while_loop.body, names);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            collect_variables(node->data.for_loop.init, names);
+            collect_variables(node->data.for_loop.condition, names);
+            collect_variables(node->data.for_loop.increment, names);
+            collect_variables(node->data.for_loop.body, names);
+            for (ReductionList *r = node->data.for_loop.reductions; r; r = r->next) {
+                names.insert(r->name);
+            }
+            break;
+        case ASTNodeType::AST_IF:
+            collect_variables(node->data.if_stmt.condition, names);
+            collect_variables(node->data.if_stmt.then_branch, names);
+            collect_variables(node->data.if_stmt.else_branch, names);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            collect_variables(node->data.switch_stmt.value, names);
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                collect_variables(arm->body, names);
+            }
+            break;
+        case ASTNodeType::AST_PRINT:
+            collect_variables(node->data.print_value, names);
+            break;
+        case ASTNodeType::AST_FUNCTION_CALL:
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                collect_variables(arg->expr, names);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+std::set<std::string> parallel_loop_variables(ASTNode *loop) {
+    std::set<std::string> names;
+    collect_variables(loop->data.for_loop.body, names);
+    names.erase(loop->data.for_loop.init->data.assignment.name);
+    for (ReductionList *r = loop->data.for_loop.reductions; r; r = r->next) {
+        names.erase(r->name);
+    }
+    return names;
+}
+
+std::set<std::string> function_variables(ASTNode *def) {
+    std::set<std::string> names;
+    for (ParamList *param = def->data.function_def.params; param; param = param->next) {
+        names.insert(param->name);
+    }
+    collect_variables(def->data.function_def.body, names);
+    return names;
+}
 
-static void add_global_var(const char *name, int value) {
-    GlobalVar *new_var = new GlobalVar(strdup(name), value, global_vars_list);
-    global_vars_list = new_var;
+static void add_global_var(GlobalVar **list, const char *name, int value) {
+    *list = new GlobalVar(strdup(name), value, *list);
 }
 
-static void collect_globals(ASTNode *node) {
+static void collect_globals(ASTNode *node, GlobalVar **list) {
     if (!node) return;
 
     if (node->type == ASTNodeType::AST_GLOBAL_VAR) {
@@ -228,18 +399,18 @@ static void collect_globals(ASTNode *node) {
             node->data.global_var.value->type == ASTNodeType::AST_NUMBER) {
             init_value = node->data.global_var.value->data.number;
         }
-        add_global_var(node->data.global_var.name, init_value);
+        add_global_var(list, node->data.global_var.name, init_value);
     } else if (node->type == ASTNodeType::AST_SEQUENCE) {
-        collect_globals(node->data.sequence.first);
-        collect_globals(node->data.sequence.second);
+        collect_globals(node->data.sequence.first, list);
+        collect_globals(node->data.sequence.second, list);
     }
     // Don't recurse into function bodies
 }
 
 GlobalVar* collect_global_vars(ASTNode *root) {
-    global_vars_list = nullptr;
-    collect_globals(root);
-    return global_vars_list;
+    GlobalVar *globals = nullptr;
+    collect_globals(root, &globals);
+    return globals;
 }
 
 void global_vars_free(GlobalVar *globals) {
@@ -250,3 +421,123 @@ void global_vars_free(GlobalVar *globals) {
         globals = next;
     }
 }
+
+// The variable of a condition variable == constant (either way round),
+// or nullptr
+static const char *equality_test(ASTNode *condition, int &value) {
+    if (condition->type != ASTNodeType::AST_BINARY_OP ||
+        condition->data.binary.op != BinaryOp::OP_EQ) {
+        return nullptr;
+    }
+    ASTNode *left = condition->data.binary.left;
+    ASTNode *right = condition->data.binary.right;
+    if (left->type == ASTNodeType::AST_NUMBER) std::swap(left, right);
+    if (left->type != ASTNodeType::AST_VARIABLE || right->type != ASTNodeType::AST_NUMBER) {
+        return nullptr;
+    }
+    value = right->data.number;
+    return left->data.variable;
+}
+
+// The ifs of a chain on one variable, outermost first: each one's else
+// branch is just the next. A repeated value ends the chain, since that
+// test can never succeed, and so does a branch hint, which a switch
+// could not keep.
+static std::vector<ASTNode*> if_chain(ASTNode *node, std::string &variable) {
+    std::vector<ASTNode*> chain;
+    std::set<int> values;
+    for (; node && node->type == ASTNodeType::AST_IF; node = node->data.if_stmt.else_branch) {
+        int value;
+        const char *name = equality_test(node->data.if_stmt.condition, value);
+        if (!name || node->data.if_stmt.hint != BranchHint::NONE ||
+            (!chain.empty() && variable != name) || !values.insert(value).second) {
+            break;
+        }
+        variable = name;
+        chain.push_back(node);
+    }
+    return chain;
+}
+
+// Rewrite the first if of chain in place as the switch; the conditions
+// and the other ifs are freed, their branches move to the arms
+static void chain_to_switch(const std::vector<ASTNode*> &chain, const std::string &variable) {
+    SwitchArm *arms = nullptr;
+    SwitchArm **tail = &arms;
+    for (ASTNode *link : chain) {
+        SwitchArm *arm = new SwitchArm();
+        int value;
+        equality_test(link->data.if_stmt.condition, value);
+        arm->values.push_back(value);
+        arm->body = link->data.if_stmt.then_branch;
+        link->data.if_stmt.then_branch = nullptr;
+        *tail = arm;
+        tail = &arm->next;
+    }
+    ASTNode *last = chain.back();
+    if (last->data.if_stmt.else_branch) {
+        SwitchArm *arm = new SwitchArm();
+        arm->is_default = true;
+        arm->body = last->data.if_stmt.else_branch;
+        last->data.if_stmt.else_branch = nullptr;
+        *tail = arm;
+    }
+
+    ASTNode *node = chain.front();
+    ast_free(node->data.if_stmt.condition);
+    ast_free(node->data.if_stmt.else_branch);
+    node->type = ASTNodeType::AST_SWITCH;
+    node->data.switch_stmt.value = ast_variable({variable.c_str(), static_cast<int>(variable.size())});
+    node->data.switch_stmt.arms = arms;
+}
+
+static void convert_statements(ASTNode *node, const char *function,
+                               std::vector<std::string> &remarks) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_SEQUENCE:
+            convert_statements(node->data.sequence.first, function, remarks);
+            convert_statements(node->data.sequence.second, function, remarks);
+            break;
+        case ASTNodeType::AST_WHILE:
+            convert_statements(node->data.while_loop.body, function, remarks);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            convert_statements(node->data.for_loop.body, function, remarks);
+            break;
+        case ASTNodeType::AST_IF: {
+            std::string variable;
+            std::vector<ASTNode*> chain = if_chain(node, variable);
+            if (chain.size() >= 3) {
+                remarks.push_back("if-else chain on " + variable + " in " + function + ": " +
+                                  std::to_string(chain.size()) + " compares made a switch");
+                chain_to_switch(chain, variable);
+                convert_statements(node, function, remarks);
+            } else {
+                convert_statements(node->data.if_stmt.then_branch, function, remarks);
+                convert_statements(node->data.if_stmt.else_branch, function, remarks);
+            }
+            break;
+        }
+        case ASTNodeType::AST_SWITCH:
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                convert_statements(arm->body, function, remarks);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void convert_if_chains(ASTNode *root, std::vector<std::string> &remarks) {
+    if (!root) return;
+
+    if (root->type == ASTNodeType::AST_FUNCTION_DEF) {
+        convert_statements(root->data.function_def.body, root->data.function_def.name, remarks);
+    } else if (root->type == ASTNodeType::AST_SEQUENCE) {
+        convert_if_chains(root->data.sequence.first, remarks);
+        convert_if_chains(root->data.sequence.second, remarks);
+    }
+}
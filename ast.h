@@ -1,18 +1,23 @@
 #ifndef AST_H
 #define AST_H
 
+#include <set>
 #include <string>
+#include <vector>
 
 enum class ASTNodeType {
     AST_NUMBER,
     AST_BINARY_OP,
+    AST_CONDITIONAL,
     AST_VARIABLE,
     AST_ASSIGNMENT,
     AST_RETURN,
     AST_SEQUENCE,
     AST_WHILE,
     AST_FOR,
+    AST_PARALLEL_FOR,
     AST_IF,
+    AST_SWITCH,
     AST_PRINT,
     AST_FUNCTION_DEF,
     AST_FUNCTION_CALL,
@@ -30,6 +35,30 @@ enum class BinaryOp {
     OP_GE,
     OP_EQ,
     OP_NE,
+    OP_AND,     // && and ||: the right operand is only evaluated if it
+    OP_OR,      // decides the result
+};
+
+// A name in the source text, as the lexer returns it. The AST creation
+// functions copy the characters.
+struct Span {
+    const char *start;
+    int length;
+};
+
+// Performance hints on a function definition, as bit flags
+enum FunctionQualifier {
+    QUALIFIER_INLINE = 1,
+    QUALIFIER_NOINLINE = 2,
+    QUALIFIER_HOT = 4,
+    QUALIFIER_COLD = 8,
+};
+
+// Expected outcome of a condition: if likely(...), while unlikely(...)
+enum class BranchHint {
+    NONE,
+    LIKELY,
+    UNLIKELY,
 };
 
 struct ParamList {
@@ -46,6 +75,27 @@ struct ArgList {
     ArgList(ASTNode *e, ArgList *nxt) : expr(e), next(nxt) {}
 };
 
+// reduce(op: name) clauses of a parallel for; op is OP_ADD or OP_MUL
+struct ReductionList {
+    BinaryOp op;
+    char *name;
+    ReductionList *next;
+
+    ReductionList(BinaryOp o, char *n, ReductionList *nxt) : op(o), name(n), next(nxt) {}
+};
+
+// One arm of a switch: the case labels that select it, and its body.
+// Labels written one after the other (case 1: case 2: ...) share an arm;
+// arms do not fall through into the next.
+struct SwitchArm {
+    std::vector<int> values;
+    bool is_default;     // Also selected by values no arm lists
+    struct ASTNode *body;
+    SwitchArm *next;
+
+    SwitchArm() : is_default(false), body(nullptr), next(nullptr) {}
+};
+
 struct GlobalVar {
     char *name;
     int value;
@@ -63,6 +113,11 @@ struct ASTNode {
             ASTNode *left;
             ASTNode *right;
         } binary;
+        struct {
+            ASTNode *condition;
+            ASTNode *then_value;
+            ASTNode *else_value;
+        } conditional;   // condition ? then_value : else_value
         char *variable;
         struct {
             char *name;
@@ -76,23 +131,31 @@ struct ASTNode {
         struct {
             ASTNode *condition;
             ASTNode *body;
+            BranchHint hint;
         } while_loop;
         struct {
             ASTNode *init;
             ASTNode *condition;
             ASTNode *increment;
             ASTNode *body;
+            ReductionList *reductions;   // AST_PARALLEL_FOR only
         } for_loop;
         struct {
             ASTNode *condition;
             ASTNode *then_branch;
             ASTNode *else_branch;
+            BranchHint hint;
         } if_stmt;
+        struct {
+            ASTNode *value;
+            SwitchArm *arms;
+        } switch_stmt;
         ASTNode *print_value;
         struct {
             char *name;
             ParamList *params;
             ASTNode *body;
+            int qualifiers;         // FunctionQualifier flags
         } function_def;
         struct {
             char *name;
@@ -108,27 +171,51 @@ struct ASTNode {
 // AST node creation functions (C-style for bison compatibility)
 ASTNode* ast_number(int value);
 ASTNode* ast_binary(BinaryOp op, ASTNode *left, ASTNode *right);
-ASTNode* ast_variable(char *name);
-ASTNode* ast_assignment(char *name, ASTNode *value);
+ASTNode* ast_conditional(ASTNode *condition, ASTNode *then_value, ASTNode *else_value);
+ASTNode* ast_variable(Span name);
+ASTNode* ast_assignment(Span name, ASTNode *value);
 ASTNode* ast_return(ASTNode *value);
 ASTNode* ast_sequence(ASTNode *first, ASTNode *second);
-ASTNode* ast_while(ASTNode *condition, ASTNode *body);
+ASTNode* ast_while(ASTNode *condition, ASTNode *body, BranchHint hint);
 ASTNode* ast_for(ASTNode *init, ASTNode *condition, ASTNode *increment, ASTNode *body);
-ASTNode* ast_if(ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch);
+ASTNode* ast_parallel_for(ASTNode *init, ASTNode *condition, ASTNode *increment,
+                          ReductionList *reductions, ASTNode *body);
+ASTNode* ast_if(ASTNode *condition, ASTNode *then_branch, ASTNode *else_branch,
+                BranchHint hint);
+ASTNode* ast_switch(ASTNode *value, SwitchArm *arms);
 ASTNode* ast_print(ASTNode *value);
-ASTNode* ast_function_def(char *name, ParamList *params, ASTNode *body);
-ASTNode* ast_function_call(char *name, ArgList *args);
-ASTNode* ast_global_var(char *name, ASTNode *value);
+ASTNode* ast_function_def(Span name, ParamList *params, ASTNode *body, int qualifiers);
+ASTNode* ast_function_call(Span name, ArgList *args);
+ASTNode* ast_global_var(Span name, ASTNode *value);
+
+const char* ast_node_type_name(ASTNodeType type);
 
 // List helpers
-ParamList* param_list_create(char *name, ParamList *next);
+ParamList* param_list_create(Span name, ParamList *next);
 ArgList* arg_list_create(ASTNode *expr, ArgList *next);
 int param_list_count(ParamList *params);
 int arg_list_count(ArgList *args);
 void param_list_free(ParamList *params);
 void arg_list_free(ArgList *args);
+ReductionList* reduction_list_create(BinaryOp op, Span name, ReductionList *next);
+void reduction_list_free(ReductionList *reductions);
+void switch_arms_free(SwitchArm *arms);
 void ast_free(ASTNode *node);
 
+// Variables that the body of a parallel for uses, apart from its loop
+// variable and reduction variables, globals included
+std::set<std::string> parallel_loop_variables(ASTNode *loop);
+
+// Variables that a function definition reads or assigns, parameters
+// included
+std::set<std::string> function_variables(ASTNode *def);
+
+// Turn each chain of at least three ifs that compare the same variable
+// with different constants (if (x == 1) {...} else { if (x == 2) ...})
+// into a switch, which codegen can lower to a jump table instead of a
+// ladder of compares. Explains each rewrite in remarks.
+void convert_if_chains(ASTNode *root, std::vector<std::string> &remarks);
+
 // Global variable collection
 GlobalVar* collect_global_vars(ASTNode *root);
 void global_vars_free(GlobalVar *globals);
@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+int add(int a, int b) {
+    return a + b;
+}
+
+int half(int x) {
+    return x / 2;
+}
+
+int mix(int x, int y) {
+    return half(add(x, y));
+}
+
+int main(void) {
+    int acc = 0;
+    for (int i = 0; i < 50000000; i = i + 1) {
+        acc = mix(acc, i);
+    }
+    printf("%d\n", acc);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+int main(void) {
+    int state = 1;
+    int acc = 0;
+    for (int i = 0; i < 50000000; i = i + 1) {
+        state = state * 75 + 74;
+        state = state - state / 65537 * 65537;
+        int op = state - state / 16 * 16;
+        switch (op) {
+        case 0: acc = acc + 1; break;
+        case 1: acc = acc - 3; break;
+        case 2: acc = acc * 3; break;
+        case 3: acc = acc / 2; break;
+        case 4: acc = acc + state; break;
+        case 5: acc = acc - state / 3; break;
+        case 6: acc = acc * 5 + 1; break;
+        case 7: acc = acc / 3 + 7; break;
+        case 8: acc = acc + 11; break;
+        case 9: acc = acc - 13; break;
+        case 10: acc = acc * 7; break;
+        case 11: acc = acc / 5 + 1; break;
+        case 12: acc = acc + state * 2; break;
+        case 13: acc = acc - 17; break;
+        case 14: acc = acc * 9 - 2; break;
+        case 15: acc = acc / 7 + 3; break;
+        }
+        acc = acc - acc / 1000003 * 1000003;
+    }
+    printf("%d\n", acc);
+    return 0;
+}
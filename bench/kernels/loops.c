@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+int main(void) {
+    int sum = 0;
+    for (int i = 0; i < 3000; i = i + 1) {
+        for (int j = 0; j < 3000; j = j + 1) {
+            sum = sum + (i * j) / (j + 1) - i / 2;
+            if (sum > 1000000) {
+                sum = sum - 1000000;
+            }
+        }
+    }
+    printf("%d\n", sum);
+    return 0;
+}
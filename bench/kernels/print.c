@@ -0,0 +1,8 @@
+#include <stdio.h>
+
+int main(void) {
+    for (int i = 0; i < 2000000; i = i + 1) {
+        printf("%d\n", i * 7);
+    }
+    return 0;
+}
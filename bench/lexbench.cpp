@@ -0,0 +1,78 @@
+// Lexer throughput benchmark: scans (and separately parses) a large
+// generated program and reports MB/s, best of several runs.
+//
+// Usage: lexbench [megabytes] [runs]   (default 16 MB, 5 runs)
+
+#include "context.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static std::string generate_source(size_t bytes) {
+    std::string source;
+    source.reserve(bytes + 256);
+    for (int i = 0; source.size() < bytes; i++) {
+        std::string n = std::to_string(i);
+        source += "function_" + n + "(alpha, beta) {\n"
+                  "    total = alpha * 12345 + beta;\n"
+                  "    while (total > 100) { total = total / 2; }\n"
+                  "    for (i = 0; i < beta; i = i + 1) { total = total - i; }\n"
+                  "    if (total == " + n + ") { print(total); } else { total = total - 1; }\n"
+                  "    return total;\n"
+                  "}\n";
+    }
+    source += "main() { return 0; }\n";
+    return source;
+}
+
+template <typename Fn>
+static double best_seconds(int runs, Fn fn) {
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    if (megabytes == 0 || runs <= 0) {
+        fprintf(stderr, "Usage: %s [megabytes] [runs]\n", argv[0]);
+        return 1;
+    }
+
+    std::string source = generate_source(megabytes << 20);
+    double mb = source.size() / double(1 << 20);
+
+    long tokens = 0;
+    double lex = best_seconds(runs, [&] {
+        CompileContext ctx;
+        tokens = scan_tokens(&ctx, source.data(), source.size());
+    });
+    if (tokens < 0) {
+        fprintf(stderr, "Scanning failed\n");
+        return 1;
+    }
+
+    bool parsed = true;
+    double parse = best_seconds(runs, [&] {
+        CompileContext ctx;
+        parsed = parse_program(&ctx, source.c_str()) == 0 && parsed;
+    });
+    if (!parsed) {
+        fprintf(stderr, "Parsing failed\n");
+        return 1;
+    }
+
+    printf("Input:        %.1f MB, %ld tokens\n", mb, tokens);
+    printf("Lex:          %8.1f MB/s  %8.1f Mtokens/s\n", mb / lex, tokens / lex / 1e6);
+    printf("Lex + parse:  %8.1f MB/s  %8.1f Mtokens/s\n", mb / parse, tokens / parse / 1e6);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#!/bin/bash
+
+# Scaling benchmark for parallel for: runs one parallel kernel on 1, 2,
+# 4, ... threads up to the number of CPUs, and reports the best time and
+# the speedup over one thread. The kernel counts primes by trial
+# division, so later iterations take longer and the work stealing of the
+# runtime has something to balance.
+#
+# Usage: ./parallel.sh [runs]   (best wall-clock time of <runs> runs, default 5)
+
+RUNS="${1:-5}"
+
+# Change to bench directory
+cd "$(dirname "$0")"
+
+# Check if compiler and runtime exist
+if [ ! -f "../build/3cc" ] || [ ! -f "../build/lib3cc_rt.a" ]; then
+  echo "Error: Compiler or runtime not found in ../build"
+  echo "Please build the compiler first with: cd .. && ./build.sh"
+  exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+KERNEL="main() {
+    count = 0;
+    parallel for (n = 2; n < 5000000; n = n + 1) reduce(+: count) {
+        prime = 1;
+        d = 2;
+        while (d * d <= n * prime) {
+            if (n - n / d * d == 0) { prime = 0; }
+            d = d + 1;
+        }
+        count = count + prime;
+    }
+    print(count);
+    return 0;
+}"
+
+if ! ../build/3cc -O2 "$KERNEL" "$WORK/primes.o" > /dev/null ||
+   ! clang -o "$WORK/primes" "$WORK/primes.o" ../build/lib3cc_rt.a -lpthread -ldl; then
+  echo "Error: could not build the kernel"
+  exit 1
+fi
+
+# Best wall-clock time in milliseconds of RUNS runs with $1 threads
+time_best() {
+  best=""
+  for ((r = 0; r < RUNS; r++)); do
+    ms=$(THREECC_NUM_THREADS="$1" perl -MTime::HiRes=time -e \
+      '$t = time; system(@ARGV); printf STDERR "%.3f\n", (time - $t) * 1000' \
+      "$WORK/primes" 2>&1 > /dev/null)
+    if [ -z "$best" ] || awk "BEGIN { exit !($ms < $best) }"; then
+      best="$ms"
+    fi
+  done
+  echo "$best"
+}
+
+cpus=$(getconf _NPROCESSORS_ONLN)
+expected=$(THREECC_NUM_THREADS=1 "$WORK/primes")
+
+printf "%-8s %12s %8s\n" "threads" "time" "speedup"
+status=0
+threads=1
+while [ "$threads" -le "$cpus" ]; do
+  if [ "$(THREECC_NUM_THREADS=$threads "$WORK/primes")" != "$expected" ]; then
+    printf "%-8s %12s\n" "$threads" "wrong output"
+    status=1
+  else
+    ms=$(time_best "$threads")
+    if [ "$threads" = 1 ]; then
+      base="$ms"
+    fi
+    speedup=$(awk "BEGIN { printf \"%.2f\", $base / ($ms > 0 ? $ms : 1) }")
+    printf "%-8s %9.1f ms %7sx\n" "$threads" "$ms" "$speedup"
+  fi
+
+  # Powers of two, and all CPUs last
+  if [ "$threads" -lt "$cpus" ] && [ $((threads * 2)) -gt "$cpus" ]; then
+    threads="$cpus"
+  else
+    threads=$((threads * 2))
+  fi
+done
+
+exit $status
@@ -0,0 +1,76 @@
+#!/bin/bash
+
+# Runtime benchmark: compares the code 3cc generates at each -O level
+# against the same kernel written in C and built with clang -O2.
+#
+# Usage: ./run.sh [runs]   (best wall-clock time of <runs> runs, default 5)
+
+RUNS="${1:-5}"
+LEVELS="0 1 2 3"
+
+# Change to bench directory
+cd "$(dirname "$0")"
+
+# Check if compiler exists
+if [ ! -f "../build/3cc" ]; then
+  echo "Error: Compiler not found at ../build/3cc"
+  echo "Please build the compiler first with: cd .. && ./build.sh"
+  exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Best wall-clock time in milliseconds of RUNS runs of a binary
+time_best() {
+  best=""
+  for ((r = 0; r < RUNS; r++)); do
+    ms=$(perl -MTime::HiRes=time -e \
+      '$t = time; system(@ARGV); printf STDERR "%.3f\n", (time - $t) * 1000' \
+      "$1" 2>&1 > /dev/null)
+    if [ -z "$best" ] || awk "BEGIN { exit !($ms < $best) }"; then
+      best="$ms"
+    fi
+  done
+  echo "$best"
+}
+
+printf "%-8s %12s" "kernel" "clang -O2"
+for level in $LEVELS; do
+  printf " %20s" "3cc -O$level"
+done
+echo
+
+status=0
+for src in kernels/*.3cc; do
+  kernel=$(basename "$src" .3cc)
+
+  clang -O2 -o "$WORK/$kernel.clang" "kernels/$kernel.c"
+  expected=$("$WORK/$kernel.clang" | cksum)
+  base=$(time_best "$WORK/$kernel.clang")
+
+  printf "%-8s %9.1f ms" "$kernel" "$base"
+
+  for level in $LEVELS; do
+    bin="$WORK/$kernel.O$level"
+    if ! ../build/3cc "-O$level" "$(cat "$src")" "$bin.o" > /dev/null ||
+       ! clang -o "$bin" "$bin.o"; then
+      printf " %20s" "compile failed"
+      status=1
+      continue
+    fi
+
+    if [ "$("$bin" | cksum)" != "$expected" ]; then
+      printf " %20s" "wrong output"
+      status=1
+      continue
+    fi
+
+    ms=$(time_best "$bin")
+    ratio=$(awk "BEGIN { printf \"%.2f\", $ms / ($base > 0 ? $base : 1) }")
+    printf " %9.1f ms %6sx" "$ms" "$ratio"
+  done
+  echo
+done
+
+exit $status
@@ -0,0 +1,80 @@
+#!/bin/bash
+
+# Size benchmark: compares the text and data of what 3cc builds at -Os and
+# -Oz with the default -O2 build of each kernel. When 3cc can link
+# executables itself (built with lld), the executables are measured, which
+# includes the built-in runtime and what --gc-sections removes; otherwise
+# the object files are, and the outputs are checked by linking with clang.
+#
+# Usage: ./size.sh
+
+LEVELS="-O2 -Os -Oz"
+
+# Change to bench directory
+cd "$(dirname "$0")"
+
+# Check if compiler exists
+if [ ! -f "../build/3cc" ]; then
+  echo "Error: Compiler not found at ../build/3cc"
+  echo "Please build the compiler first with: cd .. && ./build.sh"
+  exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if ../build/3cc -o "$WORK/probe" "main() { return 0; }" > /dev/null 2>&1; then
+  mode="executable"
+else
+  mode="object"
+  echo "(3cc was built without lld: measuring object files)"
+fi
+
+# Build kernel $1 at level $2 into $3, and check its output against $4
+build() {
+  if [ "$mode" = "executable" ]; then
+    ../build/3cc "$2" -o "$3" "$(cat "kernels/$1.3cc")" > /dev/null || return 1
+    [ "$("$3" | cksum)" = "$4" ]
+  else
+    ../build/3cc "$2" "$(cat "kernels/$1.3cc")" "$3" > /dev/null &&
+      clang -o "$3.bin" "$3" &&
+      [ "$("$3.bin" | cksum)" = "$4" ]
+  fi
+}
+
+printf "%-10s" "kernel"
+for level in $LEVELS; do
+  printf " %22s" "$level text/data"
+done
+echo
+
+status=0
+for src in kernels/*.3cc; do
+  kernel=$(basename "$src" .3cc)
+
+  clang -O2 -o "$WORK/$kernel.clang" "kernels/$kernel.c"
+  expected=$("$WORK/$kernel.clang" | cksum)
+
+  printf "%-10s" "$kernel"
+  base=""
+  for level in $LEVELS; do
+    out="$WORK/$kernel$level"
+    if ! build "$kernel" "$level" "$out" "$expected"; then
+      printf " %22s" "failed"
+      status=1
+      continue
+    fi
+
+    read -r text data _ < <(size "$out" | awk 'NR == 2 { print $1, $2 }')
+    if [ -z "$base" ]; then
+      base=$((text + data))
+      printf " %15s/%-6s" "$text" "$data"
+    else
+      percent=$(awk "BEGIN { printf \"%.0f\", 100 * ($text + $data) / ($base > 0 ? $base : 1) }")
+      printf " %9s/%-5s %5s%%" "$text" "$data" "$percent"
+    fi
+  done
+  echo
+done
+
+exit $status
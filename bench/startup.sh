@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# Startup benchmark: time from launching 3cc to having an object file for
+# the smallest possible program. For the tiny programs 3cc usually
+# compiles, process startup and target setup dominate this number.
+#
+# Usage: ./startup.sh [runs]   (mean and best of <runs> runs, default 50)
+
+RUNS="${1:-50}"
+
+# Change to bench directory
+cd "$(dirname "$0")"
+
+# Check if compiler exists
+if [ ! -f "../build/3cc" ]; then
+  echo "Error: Compiler not found at ../build/3cc"
+  echo "Please build the compiler first with: cd .. && ./build.sh"
+  exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+perl -MTime::HiRes=time -e '
+  my ($runs, @cmd) = @ARGV;
+  my ($total, $best) = (0, undef);
+  for (1 .. $runs) {
+    my $t = time;
+    system(@cmd) == 0 or die "3cc failed\n";
+    my $ms = (time - $t) * 1000;
+    $total += $ms;
+    $best = $ms if !defined $best || $ms < $best;
+  }
+  printf "time to first object: mean %.2f ms, best %.2f ms (%d runs)\n",
+         $total / $runs, $best, $runs;
+' "$RUNS" sh -c '../build/3cc "main() { return 0; }" "$1" > /dev/null' sh "$WORK/out.o"
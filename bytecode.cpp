@@ -0,0 +1,548 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+// Translation state for one program
+struct BytecodeCompiler {
+    BytecodeProgram &program;
+    std::vector<std::string> &diagnostics;
+    std::map<std::string, int> global_index;
+    std::map<std::string, int> function_index;   // Functions defined so far
+
+    // Current function
+    BytecodeFunction *function = nullptr;
+    std::map<std::string, int> locals;
+
+    void emit(Opcode op, int32_t operand = 0) {
+        function->code.push_back({op, operand});
+    }
+
+    int here() const { return static_cast<int>(function->code.size()); }
+
+    void patch(int at, int target) { function->code[at].operand = target; }
+
+    int local_slot(const std::string &name) {
+        auto local = locals.find(name);
+        if (local != locals.end()) return local->second;
+        int slot = function->local_count++;
+        locals[name] = slot;
+        return slot;
+    }
+
+    void compile_expr(ASTNode *node);
+    void compile_stmt(ASTNode *node);
+    void compile_function(ASTNode *node);
+    void compile_toplevel(ASTNode *node);
+};
+
+void BytecodeCompiler::compile_expr(ASTNode *node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_NUMBER:
+            emit(Opcode::PUSH, node->data.number);
+            break;
+
+        case ASTNodeType::AST_VARIABLE: {
+            auto global = global_index.find(node->data.variable);
+            if (global != global_index.end()) {
+                emit(Opcode::LOAD_GLOBAL, global->second);
+            } else {
+                emit(Opcode::LOAD_LOCAL, local_slot(node->data.variable));
+            }
+            break;
+        }
+
+        case ASTNodeType::AST_CONDITIONAL: {
+            compile_expr(node->data.conditional.condition);
+            int else_jump = here();
+            emit(Opcode::JUMP_IF_ZERO);
+            compile_expr(node->data.conditional.then_value);
+            int end_jump = here();
+            emit(Opcode::JUMP);
+            patch(else_jump, here());
+            compile_expr(node->data.conditional.else_value);
+            patch(end_jump, here());
+            break;
+        }
+
+        case ASTNodeType::AST_BINARY_OP: {
+            BinaryOp op = node->data.binary.op;
+            if (op == BinaryOp::OP_AND || op == BinaryOp::OP_OR) {
+                // The left operand alone decides when it is 0 (&&) or not 0 (||)
+                compile_expr(node->data.binary.left);
+                int short_jump;
+                if (op == BinaryOp::OP_AND) {
+                    short_jump = here();
+                    emit(Opcode::JUMP_IF_ZERO);
+                } else {
+                    int right_jump = here();
+                    emit(Opcode::JUMP_IF_ZERO);
+                    short_jump = here();
+                    emit(Opcode::JUMP);
+                    patch(right_jump, here());
+                }
+                compile_expr(node->data.binary.right);
+                emit(Opcode::PUSH, 0);
+                emit(Opcode::NE);
+                int end_jump = here();
+                emit(Opcode::JUMP);
+                patch(short_jump, here());
+                emit(Opcode::PUSH, op == BinaryOp::OP_OR);
+                patch(end_jump, here());
+                break;
+            }
+
+            compile_expr(node->data.binary.left);
+            compile_expr(node->data.binary.right);
+            static const Opcode ops[] = {
+                Opcode::ADD, Opcode::SUB, Opcode::MUL, Opcode::DIV, Opcode::LT,
+                Opcode::GT, Opcode::LE, Opcode::GE, Opcode::EQ, Opcode::NE,
+            };
+            emit(ops[static_cast<int>(op)]);
+            break;
+        }
+
+        case ASTNodeType::AST_FUNCTION_CALL: {
+            std::string name = node->data.function_call.name;
+            auto callee = function_index.find(name);
+            if (callee == function_index.end()) {
+                diagnostics.push_back("Unknown function referenced: " + name);
+                emit(Opcode::PUSH, 0);
+                break;
+            }
+
+            int arg_count = 0;
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                compile_expr(arg->expr);
+                arg_count++;
+            }
+            if (arg_count != program.functions[callee->second].param_count) {
+                diagnostics.push_back("Wrong number of arguments in call to " + name);
+            }
+            emit(Opcode::CALL, callee->second);
+            break;
+        }
+
+        default:
+            diagnostics.push_back(std::string("Unexpected expression: ") +
+                                  ast_node_type_name(node->type));
+            emit(Opcode::PUSH, 0);
+            break;
+    }
+}
+
+void BytecodeCompiler::compile_stmt(ASTNode *node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_ASSIGNMENT: {
+            compile_expr(node->data.assignment.value);
+            auto global = global_index.find(node->data.assignment.name);
+            if (global != global_index.end()) {
+                emit(Opcode::STORE_GLOBAL, global->second);
+            } else {
+                emit(Opcode::STORE_LOCAL, local_slot(node->data.assignment.name));
+            }
+            break;
+        }
+
+        case ASTNodeType::AST_RETURN:
+            compile_expr(node->data.return_value);
+            emit(Opcode::RET);
+            break;
+
+        case ASTNodeType::AST_SEQUENCE:
+            compile_stmt(node->data.sequence.first);
+            compile_stmt(node->data.sequence.second);
+            break;
+
+        case ASTNodeType::AST_WHILE: {
+            int loop = here();
+            compile_expr(node->data.while_loop.condition);
+            int exit_jump = here();
+            emit(Opcode::JUMP_IF_ZERO);
+            compile_stmt(node->data.while_loop.body);
+            emit(Opcode::LOOP, loop);
+            patch(exit_jump, here());
+            break;
+        }
+
+        case ASTNodeType::AST_FOR: {
+            compile_stmt(node->data.for_loop.init);
+            int loop = here();
+            compile_expr(node->data.for_loop.condition);
+            int exit_jump = here();
+            emit(Opcode::JUMP_IF_ZERO);
+            compile_stmt(node->data.for_loop.body);
+            compile_stmt(node->data.for_loop.increment);
+            emit(Opcode::LOOP, loop);
+            patch(exit_jump, here());
+            break;
+        }
+
+        case ASTNodeType::AST_PARALLEL_FOR: {
+            // One iteration after the other, but with the semantics of the
+            // parallel loop: the bound is evaluated once, and the variables
+            // that the body uses start every iteration with the values they
+            // had before the loop
+            ASTNode *condition = node->data.for_loop.condition;
+            if (condition->type != ASTNodeType::AST_BINARY_OP) {
+                // Rejected by check_parallel_loops
+                diagnostics.push_back("Unexpected parallel loop condition");
+                break;
+            }
+            compile_stmt(node->data.for_loop.init);
+            int bound = function->local_count++;
+            compile_expr(condition->data.binary.right);
+            emit(Opcode::STORE_LOCAL, bound);
+
+            std::vector<std::pair<int, int>> saved;   // Slot and its copy
+            for (const auto &name : parallel_loop_variables(node)) {
+                if (global_index.count(name)) continue;
+                saved.emplace_back(local_slot(name), function->local_count++);
+                emit(Opcode::LOAD_LOCAL, saved.back().first);
+                emit(Opcode::STORE_LOCAL, saved.back().second);
+            }
+
+            int loop = here();
+            emit(Opcode::LOAD_LOCAL, local_slot(node->data.for_loop.init->data.assignment.name));
+            emit(Opcode::LOAD_LOCAL, bound);
+            emit(condition->data.binary.op == BinaryOp::OP_LE ? Opcode::LE : Opcode::LT);
+            int exit_jump = here();
+            emit(Opcode::JUMP_IF_ZERO);
+            compile_stmt(node->data.for_loop.body);
+            for (const auto &[slot, copy] : saved) {
+                emit(Opcode::LOAD_LOCAL, copy);
+                emit(Opcode::STORE_LOCAL, slot);
+            }
+            compile_stmt(node->data.for_loop.increment);
+            emit(Opcode::LOOP, loop);
+            patch(exit_jump, here());
+            break;
+        }
+
+        case ASTNodeType::AST_IF: {
+            compile_expr(node->data.if_stmt.condition);
+            int else_jump = here();
+            emit(Opcode::JUMP_IF_ZERO);
+            compile_stmt(node->data.if_stmt.then_branch);
+            if (node->data.if_stmt.else_branch) {
+                int end_jump = here();
+                emit(Opcode::JUMP);
+                patch(else_jump, here());
+                compile_stmt(node->data.if_stmt.else_branch);
+                patch(end_jump, here());
+            } else {
+                patch(else_jump, here());
+            }
+            break;
+        }
+
+        case ASTNodeType::AST_SWITCH: {
+            // A compare per case value, in order; the interpreter does not
+            // need codegen's jump tables
+            int value = function->local_count++;
+            compile_expr(node->data.switch_stmt.value);
+            emit(Opcode::STORE_LOCAL, value);
+
+            std::vector<std::pair<int, SwitchArm*>> case_jumps;   // Jump and its arm
+            SwitchArm *default_arm = nullptr;
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                for (int case_value : arm->values) {
+                    emit(Opcode::LOAD_LOCAL, value);
+                    emit(Opcode::PUSH, case_value);
+                    emit(Opcode::NE);
+                    case_jumps.emplace_back(here(), arm);
+                    emit(Opcode::JUMP_IF_ZERO);
+                }
+                if (arm->is_default) default_arm = arm;
+            }
+            int default_jump = here();
+            emit(Opcode::JUMP);
+
+            std::vector<int> end_jumps;
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                for (const auto &[jump, target] : case_jumps) {
+                    if (target == arm) patch(jump, here());
+                }
+                if (arm == default_arm) patch(default_jump, here());
+                compile_stmt(arm->body);
+                end_jumps.push_back(here());
+                emit(Opcode::JUMP);
+            }
+            if (!default_arm) patch(default_jump, here());
+            for (int jump : end_jumps) {
+                patch(jump, here());
+            }
+            break;
+        }
+
+        case ASTNodeType::AST_PRINT:
+            compile_expr(node->data.print_value);
+            emit(Opcode::PRINT);
+            break;
+
+        default:
+            // For expressions used as statements
+            compile_expr(node);
+            emit(Opcode::POP);
+            break;
+    }
+}
+
+void BytecodeCompiler::compile_function(ASTNode *node) {
+    std::string name = node->data.function_def.name;
+    if (function_index.count(name)) {
+        diagnostics.push_back("Function defined twice: " + name);
+        return;
+    }
+
+    // Registered before the body, so that it can call itself
+    function_index[name] = static_cast<int>(program.functions.size());
+    program.functions.push_back(BytecodeFunction());
+    function = &program.functions.back();
+    function->name = name;
+    function->def = node;
+    function->param_count = 0;
+    function->local_count = 0;
+    locals.clear();
+
+    for (ParamList *param = node->data.function_def.params; param; param = param->next) {
+        // A parameter named like a global still refers to the global, as in
+        // codegen, but keeps its slot for the argument
+        locals[param->name] = function->local_count++;
+        function->param_count++;
+    }
+
+    compile_stmt(node->data.function_def.body);
+
+    // Falling off the end of a function returns 0
+    emit(Opcode::PUSH, 0);
+    emit(Opcode::RET);
+
+    if (name == "main") {
+        program.main_function = function_index[name];
+    }
+    function = nullptr;
+}
+
+void BytecodeCompiler::compile_toplevel(ASTNode *node) {
+    if (!node) return;
+
+    if (node->type == ASTNodeType::AST_FUNCTION_DEF) {
+        compile_function(node);
+    } else if (node->type == ASTNodeType::AST_SEQUENCE) {
+        compile_toplevel(node->data.sequence.first);
+        compile_toplevel(node->data.sequence.second);
+    }
+}
+
+bool compile_bytecode(ASTNode *root, GlobalVar *globals, BytecodeProgram &program,
+                      std::vector<std::string> &diagnostics) {
+    size_t first_error = diagnostics.size();
+    BytecodeCompiler compiler{program, diagnostics};
+
+    for (GlobalVar *global = globals; global; global = global->next) {
+        compiler.global_index[global->name] = static_cast<int>(program.global_names.size());
+        program.global_names.push_back(global->name);
+        program.global_values.push_back(global->value);
+    }
+
+    compiler.compile_toplevel(root);
+    return diagnostics.size() == first_error;
+}
+
+Interpreter::Interpreter(const BytecodeProgram &program)
+    : program(program), globals(program.global_values) {
+    size_t count = program.functions.size();
+    call_counts.assign(count, 0);
+    loop_counts.assign(count, 0);
+    native_code = std::make_unique<std::atomic<void*>[]>(count);
+    for (size_t i = 0; i < count; i++) {
+        native_code[i].store(nullptr, std::memory_order_relaxed);
+    }
+    stack.reserve(1 << 16);
+}
+
+void Interpreter::set_tier_up(TierUpListener *listener, long call_threshold, long loop_threshold) {
+    this->listener = listener;
+    this->call_threshold = call_threshold;
+    this->loop_threshold = loop_threshold;
+}
+
+void Interpreter::install_native(int function, void *code) {
+    native_code[function].store(code, std::memory_order_release);
+}
+
+static int32_t call_native(void *code, const int32_t *a, int arg_count) {
+    switch (arg_count) {
+        case 0: return reinterpret_cast<int32_t (*)()>(code)();
+        case 1: return reinterpret_cast<int32_t (*)(int32_t)>(code)(a[0]);
+        case 2: return reinterpret_cast<int32_t (*)(int32_t, int32_t)>(code)(a[0], a[1]);
+        case 3: return reinterpret_cast<int32_t (*)(int32_t, int32_t, int32_t)>(code)(a[0], a[1], a[2]);
+        case 4:
+            return reinterpret_cast<int32_t (*)(int32_t, int32_t, int32_t, int32_t)>(code)(
+                a[0], a[1], a[2], a[3]);
+        case 5:
+            return reinterpret_cast<int32_t (*)(int32_t, int32_t, int32_t, int32_t, int32_t)>(code)(
+                a[0], a[1], a[2], a[3], a[4]);
+        default:
+            return reinterpret_cast<int32_t (*)(int32_t, int32_t, int32_t, int32_t, int32_t, int32_t)>(
+                code)(a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+}
+
+bool Interpreter::call(int function, const std::vector<int32_t> &args, int32_t &result) {
+    failure.clear();
+    return execute(function, args.data(), result);
+}
+
+bool Interpreter::execute(int function, const int32_t *args, int32_t &result) {
+    const BytecodeFunction &func = program.functions[function];
+
+    if (void *code = native_code[function].load(std::memory_order_acquire)) {
+        result = call_native(code, args, func.param_count);
+        return true;
+    }
+
+    if (listener && ++call_counts[function] == call_threshold) {
+        listener->function_is_hot(function);
+    }
+    if (depth_limit && depth >= depth_limit) {
+        failure = "call depth limit reached";
+        return false;
+    }
+
+    // Locals start at 0, like variables read before assignment in codegen
+    size_t base = stack.size();
+    stack.resize(base + func.local_count, 0);
+    std::copy(args, args + func.param_count, stack.begin() + base);
+
+    const Instruction *code = func.code.data();
+    size_t pc = 0;
+    for (;;) {
+        if (step_limit && ++steps > step_limit) {
+            failure = "step limit reached";
+            stack.resize(base);
+            return false;
+        }
+
+        const Instruction &inst = code[pc++];
+        switch (inst.op) {
+            case Opcode::PUSH:
+                stack.push_back(inst.operand);
+                break;
+            case Opcode::POP:
+                stack.pop_back();
+                break;
+            case Opcode::LOAD_LOCAL:
+                stack.push_back(stack[base + inst.operand]);
+                break;
+            case Opcode::STORE_LOCAL:
+                stack[base + inst.operand] = stack.back();
+                stack.pop_back();
+                break;
+            case Opcode::LOAD_GLOBAL:
+                stack.push_back(globals[inst.operand]);
+                break;
+            case Opcode::STORE_GLOBAL:
+                globals[inst.operand] = stack.back();
+                stack.pop_back();
+                break;
+
+            // Arithmetic wraps like the i32 operations in the generated code
+            case Opcode::ADD:
+            case Opcode::SUB:
+            case Opcode::MUL:
+            case Opcode::DIV:
+            case Opcode::LT:
+            case Opcode::GT:
+            case Opcode::LE:
+            case Opcode::GE:
+            case Opcode::EQ:
+            case Opcode::NE: {
+                int32_t right = stack.back();
+                stack.pop_back();
+                int32_t left = stack.back();
+                if (inst.op == Opcode::DIV &&
+                    (right == 0 || (left == INT32_MIN && right == -1))) {
+                    failure = "division by zero or overflow";
+                    stack.resize(base);
+                    return false;
+                }
+                uint32_t l = static_cast<uint32_t>(left), r = static_cast<uint32_t>(right);
+                int32_t value;
+                switch (inst.op) {
+                    case Opcode::ADD: value = static_cast<int32_t>(l + r); break;
+                    case Opcode::SUB: value = static_cast<int32_t>(l - r); break;
+                    case Opcode::MUL: value = static_cast<int32_t>(l * r); break;
+                    case Opcode::DIV: value = left / right; break;
+                    case Opcode::LT: value = left < right; break;
+                    case Opcode::GT: value = left > right; break;
+                    case Opcode::LE: value = left <= right; break;
+                    case Opcode::GE: value = left >= right; break;
+                    case Opcode::EQ: value = left == right; break;
+                    default: value = left != right; break;
+                }
+                stack.back() = value;
+                break;
+            }
+
+            case Opcode::JUMP:
+                pc = inst.operand;
+                break;
+            case Opcode::JUMP_IF_ZERO: {
+                int32_t cond = stack.back();
+                stack.pop_back();
+                if (cond == 0) pc = inst.operand;
+                break;
+            }
+            case Opcode::LOOP:
+                if (listener && ++loop_counts[function] == loop_threshold) {
+                    listener->function_is_hot(function);
+                }
+                pc = inst.operand;
+                break;
+
+            case Opcode::CALL: {
+                const BytecodeFunction &callee = program.functions[inst.operand];
+                int32_t call_args[MAX_NATIVE_ARGS];
+                std::vector<int32_t> spilled;
+                const int32_t *arg_values;
+                size_t first = stack.size() - callee.param_count;
+                if (callee.param_count <= MAX_NATIVE_ARGS) {
+                    std::copy(stack.begin() + first, stack.end(), call_args);
+                    arg_values = call_args;
+                } else {
+                    spilled.assign(stack.begin() + first, stack.end());
+                    arg_values = spilled.data();
+                }
+                stack.resize(first);
+
+                int32_t value;
+                depth++;
+                bool finished = execute(inst.operand, arg_values, value);
+                depth--;
+                if (!finished) {
+                    stack.resize(base);
+                    return false;
+                }
+                stack.push_back(value);
+                break;
+            }
+
+            case Opcode::RET:
+                result = stack.back();
+                stack.resize(base);
+                return true;
+
+            case Opcode::PRINT:
+                printf("%d\n", stack.back());
+                stack.pop_back();
+                break;
+        }
+    }
+}
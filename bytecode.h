@@ -0,0 +1,124 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ast.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Compact stack bytecode for the interpreter tier. Values are 32-bit
+// integers with the same wrapping semantics as the generated code.
+enum class Opcode : uint8_t {
+    PUSH,           // operand: value
+    POP,
+    LOAD_LOCAL,     // operand: slot
+    STORE_LOCAL,    // operand: slot
+    LOAD_GLOBAL,    // operand: global index
+    STORE_GLOBAL,   // operand: global index
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    LT,
+    GT,
+    LE,
+    GE,
+    EQ,
+    NE,
+    JUMP,           // operand: target
+    JUMP_IF_ZERO,   // operand: target
+    LOOP,           // operand: target; a loop back edge
+    CALL,           // operand: function index
+    RET,
+    PRINT,
+};
+
+struct Instruction {
+    Opcode op;
+    int32_t operand;
+};
+
+struct BytecodeFunction {
+    std::string name;
+    ASTNode *def;               // Owned by the AST
+    int param_count;            // Parameters occupy the first local slots
+    int local_count;
+    std::vector<Instruction> code;
+};
+
+struct BytecodeProgram {
+    std::vector<BytecodeFunction> functions;   // In source order
+    std::vector<std::string> global_names;
+    std::vector<int32_t> global_values;        // Initial values
+    int main_function = -1;
+};
+
+// Translate the program, with the same rules as codegen: a function can
+// only call itself and functions defined before it.
+bool compile_bytecode(ASTNode *root, GlobalVar *globals, BytecodeProgram &program,
+                      std::vector<std::string> &diagnostics);
+
+// Notified by the interpreter when a function becomes hot
+class TierUpListener {
+public:
+    virtual ~TierUpListener() = default;
+    virtual void function_is_hot(int function) = 0;
+};
+
+class Interpreter {
+private:
+    const BytecodeProgram &program;
+    std::vector<int32_t> stack;   // Locals and operands of all active calls
+
+    uint64_t steps = 0;
+    uint64_t step_limit = 0;      // 0 for no limit
+    int depth = 0;
+    int depth_limit = 0;          // 0 for no limit
+    std::string failure;
+
+    // Tiering state, per function
+    TierUpListener *listener = nullptr;
+    long call_threshold = 0;
+    long loop_threshold = 0;
+    std::vector<long> call_counts;
+    std::vector<long> loop_counts;
+    std::unique_ptr<std::atomic<void*>[]> native_code;
+
+    bool execute(int function, const int32_t *args, int32_t &result);
+
+public:
+    std::vector<int32_t> globals;
+
+    explicit Interpreter(const BytecodeProgram &program);
+
+    // Stop, failing the call, after this many instructions in total
+    void set_step_limit(uint64_t limit) { step_limit = limit; }
+    uint64_t steps_executed() const { return steps; }
+
+    // Fail calls that nest deeper than this
+    void set_depth_limit(int limit) { depth_limit = limit; }
+
+    // Report functions to listener once they have been called
+    // call_threshold times, or have run loop_threshold loop iterations
+    void set_tier_up(TierUpListener *listener, long call_threshold, long loop_threshold);
+    // Only on the thread that runs the interpreter, which updates them
+    long call_count(int function) const { return call_counts[function]; }
+    long loop_count(int function) const { return loop_counts[function]; }
+
+    // Route later calls of function to native code taking its arguments
+    // as int32_t and returning int32_t. May be called from any thread.
+    void install_native(int function, void *code);
+
+    // Returns false if a limit was reached or on division by zero, with
+    // the reason in failure_reason()
+    bool call(int function, const std::vector<int32_t> &args, int32_t &result);
+    const std::string &failure_reason() const { return failure; }
+};
+
+// Native calls are dispatched by arity, up to this many arguments
+constexpr int MAX_NATIVE_ARGS = 6;
+
+#endif /* BYTECODE_H */
@@ -1,33 +1,151 @@
 #include "codegen.h"
+#include "runtime.h"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/MC/TargetRegistry.h>
-#include <llvm/Support/FileSystem.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/TargetParser/Host.h>
-#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/DCE.h>
 #include <llvm/Transforms/Scalar/GVN.h>
-#include <llvm/Transforms/Utils.h>
-#include <iostream>
+#include <llvm/Transforms/Scalar/Reassociate.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/EntryExitInstrumenter.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <algorithm>
 #include <cstring>
+#include <mutex>
+
+#define DEBUG_TYPE "3cc-codegen"
+
+STATISTIC(NumFunctionsGenerated, "Number of functions generated");
+STATISTIC(NumPhisCreated, "Number of phi nodes created");
+STATISTIC(NumTrivialPhisRemoved, "Number of trivial phi nodes removed");
+STATISTIC(NumLoadsEmitted, "Number of global variable loads emitted");
+STATISTIC(NumStoresEmitted, "Number of global variable stores emitted");
+STATISTIC(NumSwitches, "Number of switch statements generated");
+STATISTIC(NumBranchFree, "Number of &&, || and ?: generated without branches");
+STATISTIC(NumShortCircuits, "Number of &&, || and ?: generated with branches");
+STATISTIC(NumParallelLoops, "Number of parallel loop bodies outlined");
+STATISTIC(NumFunctionVersions, "Number of function clones for x86-64 levels");
+
+bool initialize_target(const llvm::Triple &triple) {
+    // Target registration is process-wide, so each backend is registered
+    // once, by the first compilation that asks for it. Only backends that
+    // were built into 3cc (THREECC_TARGETS) are available.
+    switch (triple.getArch()) {
+#ifdef THREECC_TARGET_X86
+        case llvm::Triple::x86:
+        case llvm::Triple::x86_64: {
+            static std::once_flag x86_init;
+            std::call_once(x86_init, [] {
+                LLVMInitializeX86TargetInfo();
+                LLVMInitializeX86Target();
+                LLVMInitializeX86TargetMC();
+                LLVMInitializeX86AsmPrinter();
+                LLVMInitializeX86AsmParser();
+            });
+            return true;
+        }
+#endif
+#ifdef THREECC_TARGET_AARCH64
+        case llvm::Triple::aarch64:
+        case llvm::Triple::aarch64_be: {
+            static std::once_flag aarch64_init;
+            std::call_once(aarch64_init, [] {
+                LLVMInitializeAArch64TargetInfo();
+                LLVMInitializeAArch64Target();
+                LLVMInitializeAArch64TargetMC();
+                LLVMInitializeAArch64AsmPrinter();
+                LLVMInitializeAArch64AsmParser();
+            });
+            return true;
+        }
+#endif
+        default:
+            return false;
+    }
+}
 
-SymbolTable *global_symtab = nullptr;
+bool initialize_native_target() {
+    return initialize_target(llvm::Triple(llvm::sys::getProcessTriple()));
+}
+
+// The passes that streaming runs on each function as soon as it is
+// generated, and the analysis managers they share
+struct CodeGenerator::FunctionPipeline {
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::PassBuilder pass_builder;
+    llvm::FunctionPassManager fpm;
+
+    explicit FunctionPipeline(llvm::TargetMachine *target_machine)
+        : pass_builder(target_machine) {
+        pass_builder.registerModuleAnalyses(mam);
+        pass_builder.registerCGSCCAnalyses(cgam);
+        pass_builder.registerFunctionAnalyses(fam);
+        pass_builder.registerLoopAnalyses(lam);
+        pass_builder.crossRegisterProxies(lam, fam, cgam, mam);
+    }
+};
+
+// The function-local cleanup of -O1
+static void add_cleanup_passes(llvm::FunctionPassManager &fpm) {
+    fpm.addPass(llvm::InstCombinePass());     // Combine instructions
+    fpm.addPass(llvm::ReassociatePass());     // Reassociate expressions
+    fpm.addPass(llvm::GVNPass());             // Global Value Numbering (removes redundancy)
+    fpm.addPass(llvm::SimplifyCFGPass());     // Simplify control flow graph
+    fpm.addPass(llvm::DCEPass());             // Remove dead code
+}
 
-CodeGenerator::CodeGenerator() {
+// Marks the functions of OptTier::LIGHT until optimize_module
+static const char LIGHT_TIER_ATTRIBUTE[] = "3cc-opt-tier-light";
+
+void CodeGenerator::set_function_tier(llvm::Function *func, OptTier tier) {
+    if (tier == OptTier::NONE) {
+        // optnone requires noinline
+        func->addFnAttr(llvm::Attribute::OptimizeNone);
+        func->addFnAttr(llvm::Attribute::NoInline);
+    } else if (tier == OptTier::LIGHT) {
+        func->addFnAttr(LIGHT_TIER_ATTRIBUTE);
+    }
+}
+
+CodeGenerator::CodeGenerator(bool freestanding) : freestanding(freestanding) {
     context = std::make_unique<llvm::LLVMContext>();
     module = std::make_unique<llvm::Module>("3cc", *context);
     builder = std::make_unique<llvm::IRBuilder<>>(*context);
 
     current_function = nullptr;
-    current_return_block = nullptr;
-    return_value_alloca = nullptr;
     printf_func = nullptr;
+    print_func = nullptr;
+
+    if (freestanding) {
+        create_print_declaration();
+    } else {
+        create_printf_declaration();
+    }
+}
+
+CodeGenerator::~CodeGenerator() = default;
 
-    create_printf_declaration();
+void CodeGenerator::report_error(const std::string &message) {
+    diagnostics.push_back(message);
 }
 
 void CodeGenerator::create_printf_declaration() {
@@ -46,10 +164,302 @@ void CodeGenerator::create_printf_declaration() {
     );
 }
 
-llvm::AllocaInst* CodeGenerator::create_entry_block_alloca(
-    llvm::Function *func, const std::string &var_name) {
-    llvm::IRBuilder<> tmp_builder(&func->getEntryBlock(), func->getEntryBlock().begin());
-    return tmp_builder.CreateAlloca(llvm::Type::getInt32Ty(*context), nullptr, var_name);
+void CodeGenerator::create_print_declaration() {
+    // Declare the runtime's print: void @__3cc_print(i32)
+    llvm::FunctionType *print_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*context),
+        {llvm::Type::getInt32Ty(*context)},
+        false
+    );
+
+    print_func = llvm::Function::Create(
+        print_type,
+        llvm::Function::ExternalLinkage,
+        "__3cc_print",
+        module.get()
+    );
+}
+
+void CodeGenerator::write_variable(const std::string &name, llvm::BasicBlock *block,
+                                   llvm::Value *value) {
+    current_def[name][block] = value;
+}
+
+llvm::Value* CodeGenerator::read_variable(const std::string &name, llvm::BasicBlock *block) {
+    auto defs = current_def.find(name);
+    if (defs != current_def.end()) {
+        auto def = defs->second.find(block);
+        if (def != defs->second.end() && def->second) {
+            return def->second;
+        }
+    }
+    return read_variable_recursive(name, block);
+}
+
+llvm::Value* CodeGenerator::read_variable_recursive(const std::string &name, llvm::BasicBlock *block) {
+    llvm::Value *value;
+    if (!sealed_blocks.count(block)) {
+        // More predecessors may follow: decide once the block is sealed
+        llvm::IRBuilder<> phi_builder(block, block->begin());
+        llvm::PHINode *phi = phi_builder.CreatePHI(llvm::Type::getInt32Ty(*context), 2, name);
+        ++NumPhisCreated;
+        incomplete_phis[block][name] = phi;
+        value = phi;
+    } else if (llvm::pred_empty(block)) {
+        // Read before any assignment (or in unreachable code): 0
+        value = llvm::ConstantInt::get(*context, llvm::APInt(32, 0, true));
+    } else if (llvm::BasicBlock *pred = block->getSinglePredecessor()) {
+        value = read_variable(name, pred);
+    } else {
+        // Record the phi before looking at the predecessors, so that a
+        // read reached again through a cycle stops here
+        llvm::IRBuilder<> phi_builder(block, block->begin());
+        llvm::PHINode *phi = phi_builder.CreatePHI(llvm::Type::getInt32Ty(*context), 2, name);
+        ++NumPhisCreated;
+        write_variable(name, block, phi);
+        value = add_phi_operands(name, phi);
+    }
+    write_variable(name, block, value);
+    return value;
+}
+
+llvm::Value* CodeGenerator::add_phi_operands(const std::string &name, llvm::PHINode *phi) {
+    // Read every operand before adding any, so the phi cannot be taken
+    // for trivial while it is incomplete. One incoming value per edge, so
+    // a predecessor that branches here twice is listed twice.
+    llvm::SmallVector<std::pair<llvm::BasicBlock*, llvm::WeakTrackingVH>, 4> incoming;
+    for (llvm::BasicBlock *pred : llvm::predecessors(phi->getParent())) {
+        incoming.emplace_back(pred, read_variable(name, pred));
+    }
+    for (auto &[pred, value] : incoming) {
+        phi->addIncoming(value, pred);
+    }
+    return try_remove_trivial_phi(phi);
+}
+
+llvm::Value* CodeGenerator::try_remove_trivial_phi(llvm::PHINode *phi) {
+    llvm::Value *same = nullptr;
+    for (llvm::Value *op : phi->incoming_values()) {
+        if (op == same || op == phi) continue;
+        if (same) return phi;   // Merges at least two values: not trivial
+        same = op;
+    }
+    if (!same) {
+        // Only references itself: the variable is never assigned
+        same = llvm::ConstantInt::get(*context, llvm::APInt(32, 0, true));
+    }
+
+    // Phis using this one may become trivial in turn. Use weak handles,
+    // since removing one of them can remove another.
+    llvm::SmallVector<llvm::WeakVH, 8> phi_users;
+    for (llvm::User *user : phi->users()) {
+        if (user != phi && llvm::isa<llvm::PHINode>(user)) {
+            phi_users.push_back(user);
+        }
+    }
+
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+    ++NumTrivialPhisRemoved;
+
+    llvm::WeakTrackingVH result = same;
+    for (auto &user : phi_users) {
+        if (auto *user_phi = llvm::dyn_cast_or_null<llvm::PHINode>(user)) {
+            try_remove_trivial_phi(user_phi);
+        }
+    }
+    return result;
+}
+
+void CodeGenerator::seal_block(llvm::BasicBlock *block) {
+    auto pending = incomplete_phis.find(block);
+    if (pending != incomplete_phis.end()) {
+        for (auto &[name, phi] : pending->second) {
+            add_phi_operands(name, phi);
+        }
+        incomplete_phis.erase(pending);
+    }
+    sealed_blocks.insert(block);
+}
+
+void CodeGenerator::branch_to(llvm::BasicBlock *target) {
+    // A block without predecessors (other than the entry) follows a
+    // return. Keeping it out of the CFG keeps the meaningless variable
+    // values it sees out of the phis of reachable blocks.
+    llvm::BasicBlock *block = builder->GetInsertBlock();
+    if (block != &current_function->getEntryBlock() && llvm::pred_empty(block)) {
+        return;
+    }
+    builder->CreateBr(target);
+}
+
+void CodeGenerator::start_unreachable_block() {
+    // Code after a return still needs somewhere to go. Nothing branches
+    // here, and the block is removed when the function is finished.
+    llvm::BasicBlock *block = llvm::BasicBlock::Create(*context, "afterret", current_function);
+    seal_block(block);
+    builder->SetInsertPoint(block);
+}
+
+// Weights for hinted branches: the hinted side is taken 2000 times as
+// often as the other, the same as clang's __builtin_expect
+static constexpr uint32_t HINTED_BRANCH_WEIGHT = 2000;
+
+llvm::MDNode* CodeGenerator::branch_weights(BranchHint hint) {
+    switch (hint) {
+        case BranchHint::LIKELY:
+            return llvm::MDBuilder(*context).createBranchWeights(HINTED_BRANCH_WEIGHT, 1);
+        case BranchHint::UNLIKELY:
+            return llvm::MDBuilder(*context).createBranchWeights(1, HINTED_BRANCH_WEIGHT);
+        default:
+            return nullptr;
+    }
+}
+
+// Largest operand, in AST nodes, that &&, || and ?: evaluate even when
+// the result does not need it, to do without a branch
+static constexpr int SPECULATION_LIMIT = 8;
+
+// Whether evaluating node unconditionally costs little, has no side
+// effects and cannot trap: no calls, and division only by constants
+// other than 0 and -1. budget is what is left of SPECULATION_LIMIT.
+static bool is_speculatable(ASTNode *node, int &budget) {
+    if (--budget < 0) return false;
+
+    switch (node->type) {
+        case ASTNodeType::AST_NUMBER:
+        case ASTNodeType::AST_VARIABLE:
+            return true;
+        case ASTNodeType::AST_BINARY_OP: {
+            ASTNode *right = node->data.binary.right;
+            if (node->data.binary.op == BinaryOp::OP_DIV &&
+                (right->type != ASTNodeType::AST_NUMBER || right->data.number == 0 ||
+                 right->data.number == -1)) {
+                return false;
+            }
+            return is_speculatable(node->data.binary.left, budget) &&
+                   is_speculatable(right, budget);
+        }
+        case ASTNodeType::AST_CONDITIONAL:
+            return is_speculatable(node->data.conditional.condition, budget) &&
+                   is_speculatable(node->data.conditional.then_value, budget) &&
+                   is_speculatable(node->data.conditional.else_value, budget);
+        default:
+            return false;
+    }
+}
+
+static bool is_speculatable(ASTNode *node) {
+    int budget = SPECULATION_LIMIT;
+    return is_speculatable(node, budget);
+}
+
+// value != 0 as an i1, reusing the i1 that a comparison was widened from
+static llvm::Value* truth_value(llvm::IRBuilder<> &builder, llvm::Value *value, const char *name) {
+    if (auto *zext = llvm::dyn_cast<llvm::ZExtInst>(value)) {
+        if (zext->getSrcTy()->isIntegerTy(1)) return zext->getOperand(0);
+    }
+    return builder.CreateICmpNE(value, builder.getInt32(0), name);
+}
+
+// && and ||. When the right operand is cheap and safe to evaluate anyway,
+// both are evaluated and combined with and/or on i1, without a branch.
+// Otherwise the right operand gets a block of its own, which only runs
+// when the left operand does not decide the result.
+llvm::Value* CodeGenerator::codegen_logical(ASTNode *node) {
+    bool is_and = node->data.binary.op == BinaryOp::OP_AND;
+    llvm::Type *int32 = llvm::Type::getInt32Ty(*context);
+
+    llvm::Value *left = codegen_expr(node->data.binary.left);
+    if (!left) return nullptr;
+    llvm::Value *left_bool = truth_value(*builder, left, "lhsbool");
+
+    if (is_speculatable(node->data.binary.right)) {
+        llvm::Value *right = codegen_expr(node->data.binary.right);
+        if (!right) return nullptr;
+        llvm::Value *right_bool = truth_value(*builder, right, "rhsbool");
+        ++NumBranchFree;
+        llvm::Value *result = is_and ? builder->CreateAnd(left_bool, right_bool, "andtmp")
+                                     : builder->CreateOr(left_bool, right_bool, "ortmp");
+        return builder->CreateZExt(result, int32, "booltmp");
+    }
+
+    llvm::BasicBlock *left_block = builder->GetInsertBlock();
+    llvm::BasicBlock *right_block = llvm::BasicBlock::Create(*context, is_and ? "andrhs" : "orrhs", current_function);
+    llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(*context, is_and ? "andcont" : "orcont", current_function);
+    if (is_and) {
+        builder->CreateCondBr(left_bool, right_block, merge_block);
+    } else {
+        builder->CreateCondBr(left_bool, merge_block, right_block);
+    }
+    seal_block(right_block);
+
+    builder->SetInsertPoint(right_block);
+    llvm::Value *right = codegen_expr(node->data.binary.right);
+    if (!right) return nullptr;
+    llvm::Value *right_bool = truth_value(*builder, right, "rhsbool");
+    right_block = builder->GetInsertBlock();
+    builder->CreateBr(merge_block);
+
+    seal_block(merge_block);
+    builder->SetInsertPoint(merge_block);
+    llvm::PHINode *phi = builder->CreatePHI(builder->getInt1Ty(), 2, is_and ? "andtmp" : "ortmp");
+    phi->addIncoming(builder->getInt1(!is_and), left_block);
+    phi->addIncoming(right_bool, right_block);
+    ++NumShortCircuits;
+    return builder->CreateZExt(phi, int32, "booltmp");
+}
+
+// condition ? a : b, as a select when both values are cheap and safe to
+// evaluate whatever the condition, and with a branch to each otherwise
+llvm::Value* CodeGenerator::codegen_conditional(ASTNode *node) {
+    llvm::Value *cond = codegen_expr(node->data.conditional.condition);
+    if (!cond) return nullptr;
+    llvm::Value *cond_bool = truth_value(*builder, cond, "condbool");
+
+    if (is_speculatable(node->data.conditional.then_value) &&
+        is_speculatable(node->data.conditional.else_value)) {
+        llvm::Value *then_value = codegen_expr(node->data.conditional.then_value);
+        llvm::Value *else_value = codegen_expr(node->data.conditional.else_value);
+        if (!then_value || !else_value) return nullptr;
+        ++NumBranchFree;
+        return builder->CreateSelect(cond_bool, then_value, else_value, "condtmp");
+    }
+
+    llvm::BasicBlock *then_block = llvm::BasicBlock::Create(*context, "condtrue", current_function);
+    llvm::BasicBlock *else_block = llvm::BasicBlock::Create(*context, "condfalse", current_function);
+    llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(*context, "condcont", current_function);
+    builder->CreateCondBr(cond_bool, then_block, else_block);
+    seal_block(then_block);
+    seal_block(else_block);
+
+    builder->SetInsertPoint(then_block);
+    llvm::Value *then_value = codegen_expr(node->data.conditional.then_value);
+    if (!then_value) return nullptr;
+    then_block = builder->GetInsertBlock();
+    builder->CreateBr(merge_block);
+
+    builder->SetInsertPoint(else_block);
+    llvm::Value *else_value = codegen_expr(node->data.conditional.else_value);
+    if (!else_value) return nullptr;
+    else_block = builder->GetInsertBlock();
+    builder->CreateBr(merge_block);
+
+    seal_block(merge_block);
+    builder->SetInsertPoint(merge_block);
+    llvm::PHINode *phi = builder->CreatePHI(builder->getInt32Ty(), 2, "condtmp");
+    phi->addIncoming(then_value, then_block);
+    phi->addIncoming(else_value, else_block);
+    ++NumShortCircuits;
+    return phi;
+}
+
+// The "%d\n" that every print passes to printf, created by the first one
+llvm::Value* CodeGenerator::print_format() {
+    if (llvm::GlobalVariable *format = module->getNamedGlobal("print.format")) {
+        return format;
+    }
+    return builder->CreateGlobalString("%d\n", "print.format");
 }
 
 bool CodeGenerator::is_global_var(const std::string &name) const {
@@ -69,20 +479,21 @@ llvm::Value* CodeGenerator::codegen_expr(ASTNode *node) {
             // Check if it's a global variable
             if (is_global_var(name)) {
                 auto global = global_vars[name];
+                ++NumLoadsEmitted;
                 return builder->CreateLoad(llvm::Type::getInt32Ty(*context), global, name);
             }
 
             // Local variable
-            llvm::AllocaInst *alloca = named_values[name];
-            if (!alloca) {
-                // Variable not found, create it
-                alloca = create_entry_block_alloca(current_function, name);
-                named_values[name] = alloca;
-            }
-            return builder->CreateLoad(llvm::Type::getInt32Ty(*context), alloca, name);
+            return read_variable(name, builder->GetInsertBlock());
         }
 
+        case ASTNodeType::AST_CONDITIONAL:
+            return codegen_conditional(node);
+
         case ASTNodeType::AST_BINARY_OP: {
+            if (node->data.binary.op == BinaryOp::OP_AND || node->data.binary.op == BinaryOp::OP_OR) {
+                return codegen_logical(node);
+            }
             llvm::Value *left = codegen_expr(node->data.binary.left);
             llvm::Value *right = codegen_expr(node->data.binary.right);
 
@@ -131,8 +542,20 @@ llvm::Value* CodeGenerator::codegen_expr(ASTNode *node) {
 
             // Look up the function in the module
             llvm::Function *callee = module->getFunction(name);
+            int arg_count = arg_list_count(node->data.function_call.args);
+            if (!callee && streaming) {
+                // Defined further on, as finish_streaming checks
+                declare_function(name, arg_count);
+                callee = module->getFunction(name);
+                forward_declared.insert(name);
+            }
             if (!callee) {
-                std::cerr << "Unknown function referenced: " << name << std::endl;
+                report_error("Unknown function referenced: " + name);
+                return nullptr;
+            }
+            if (callee->arg_size() != static_cast<size_t>(arg_count)) {
+                report_error("Function " + name + " takes " + std::to_string(callee->arg_size()) +
+                             " arguments, but is called with " + std::to_string(arg_count));
                 return nullptr;
             }
 
@@ -166,25 +589,20 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
             // Check if it's a global variable
             if (is_global_var(name)) {
                 builder->CreateStore(val, global_vars[name]);
+                ++NumStoresEmitted;
                 return;
             }
 
             // Local variable
-            llvm::AllocaInst *alloca = named_values[name];
-            if (!alloca) {
-                // Variable not found, create it
-                alloca = create_entry_block_alloca(current_function, name);
-                named_values[name] = alloca;
-            }
-            builder->CreateStore(val, alloca);
+            write_variable(name, builder->GetInsertBlock(), val);
             break;
         }
 
         case ASTNodeType::AST_RETURN: {
             llvm::Value *ret_val = codegen_expr(node->data.return_value);
-            if (ret_val && return_value_alloca) {
-                builder->CreateStore(ret_val, return_value_alloca);
-                builder->CreateBr(current_return_block);
+            if (ret_val) {
+                builder->CreateRet(ret_val);
+                start_unreachable_block();
             }
             break;
         }
@@ -199,8 +617,9 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
             llvm::BasicBlock *body_block = llvm::BasicBlock::Create(*context, "loopbody", current_function);
             llvm::BasicBlock *after_block = llvm::BasicBlock::Create(*context, "afterloop", current_function);
 
-            // Jump to loop condition
-            builder->CreateBr(loop_block);
+            // Jump to loop condition. The back edge is not known yet, so the
+            // header stays unsealed until the body has been generated.
+            branch_to(loop_block);
             builder->SetInsertPoint(loop_block);
 
             // Evaluate condition
@@ -214,12 +633,16 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
                 "loopcond"
             );
 
-            builder->CreateCondBr(cond_bool, body_block, after_block);
+            builder->CreateCondBr(cond_bool, body_block, after_block,
+                                  branch_weights(node->data.while_loop.hint));
+            seal_block(body_block);
+            seal_block(after_block);
 
             // Emit loop body
             builder->SetInsertPoint(body_block);
             codegen_stmt(node->data.while_loop.body);
-            builder->CreateBr(loop_block);
+            branch_to(loop_block);
+            seal_block(loop_block);
 
             // Continue after loop
             builder->SetInsertPoint(after_block);
@@ -234,8 +657,8 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
             llvm::BasicBlock *body_block = llvm::BasicBlock::Create(*context, "forbody", current_function);
             llvm::BasicBlock *after_block = llvm::BasicBlock::Create(*context, "afterfor", current_function);
 
-            // Jump to loop condition
-            builder->CreateBr(loop_block);
+            // Jump to loop condition; sealed after the back edge, as for while
+            branch_to(loop_block);
             builder->SetInsertPoint(loop_block);
 
             // Evaluate condition
@@ -250,18 +673,25 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
             );
 
             builder->CreateCondBr(cond_bool, body_block, after_block);
+            seal_block(body_block);
+            seal_block(after_block);
 
             // Emit loop body
             builder->SetInsertPoint(body_block);
             codegen_stmt(node->data.for_loop.body);
             codegen_stmt(node->data.for_loop.increment);
-            builder->CreateBr(loop_block);
+            branch_to(loop_block);
+            seal_block(loop_block);
 
             // Continue after loop
             builder->SetInsertPoint(after_block);
             break;
         }
 
+        case ASTNodeType::AST_PARALLEL_FOR:
+            codegen_parallel_for(node);
+            break;
+
         case ASTNodeType::AST_IF: {
             llvm::Value *cond = codegen_expr(node->data.if_stmt.condition);
             if (!cond) return;
@@ -279,29 +709,69 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
             llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(*context, "ifcont", current_function);
 
             // Branch based on condition
+            llvm::MDNode *weights = branch_weights(node->data.if_stmt.hint);
             if (else_block) {
-                builder->CreateCondBr(cond_bool, then_block, else_block);
+                builder->CreateCondBr(cond_bool, then_block, else_block, weights);
+                seal_block(else_block);
             } else {
-                builder->CreateCondBr(cond_bool, then_block, merge_block);
+                builder->CreateCondBr(cond_bool, then_block, merge_block, weights);
             }
+            seal_block(then_block);
 
             // Emit then block
             builder->SetInsertPoint(then_block);
             codegen_stmt(node->data.if_stmt.then_branch);
-            if (!builder->GetInsertBlock()->getTerminator()) {
-                builder->CreateBr(merge_block);
-            }
+            branch_to(merge_block);
 
             // Emit else block if it exists
             if (else_block) {
                 builder->SetInsertPoint(else_block);
                 codegen_stmt(node->data.if_stmt.else_branch);
-                if (!builder->GetInsertBlock()->getTerminator()) {
-                    builder->CreateBr(merge_block);
+                branch_to(merge_block);
+            }
+
+            // Continue with merge block, whose predecessors are all known now
+            seal_block(merge_block);
+            builder->SetInsertPoint(merge_block);
+            break;
+        }
+
+        case ASTNodeType::AST_SWITCH: {
+            llvm::Value *value = codegen_expr(node->data.switch_stmt.value);
+            if (!value) return;
+
+            // An LLVM switch, which the backend lowers to a jump table, a
+            // binary search or compares, whichever suits the case values
+            llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(*context, "switchcont", current_function);
+            llvm::BasicBlock *default_block = merge_block;
+            std::vector<llvm::BasicBlock*> arm_blocks;
+            unsigned case_count = 0;
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                arm_blocks.push_back(llvm::BasicBlock::Create(
+                    *context, arm->is_default ? "default" : "case", current_function));
+                if (arm->is_default) default_block = arm_blocks.back();
+                case_count += arm->values.size();
+            }
+
+            llvm::SwitchInst *switch_inst = builder->CreateSwitch(value, default_block, case_count);
+            ++NumSwitches;
+            size_t index = 0;
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next, index++) {
+                for (int case_value : arm->values) {
+                    switch_inst->addCase(builder->getInt32(case_value), arm_blocks[index]);
                 }
+                seal_block(arm_blocks[index]);
+            }
+
+            // Arms do not fall through: each ends at the merge block
+            index = 0;
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next, index++) {
+                builder->SetInsertPoint(arm_blocks[index]);
+                codegen_stmt(arm->body);
+                branch_to(merge_block);
             }
 
-            // Continue with merge block
+            seal_block(merge_block);
             builder->SetInsertPoint(merge_block);
             break;
         }
@@ -310,16 +780,19 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
             llvm::Value *val = codegen_expr(node->data.print_value);
             if (!val) return;
 
-            // Create format string "%d\n"
-            llvm::Value *format_str = builder->CreateGlobalString("%d\n");
+            if (freestanding) {
+                builder->CreateCall(print_func, {val});
+                break;
+            }
 
-            // Call printf
-            builder->CreateCall(printf_func, {format_str, val});
+            builder->CreateCall(printf_func, {print_format(), val});
             break;
         }
 
         case ASTNodeType::AST_FUNCTION_DEF:
-            codegen_function_def(node);
+            if (!skipped_functions.count(node->data.function_def.name)) {
+                codegen_function_def(node);
+            }
             break;
 
         case ASTNodeType::AST_GLOBAL_VAR:
@@ -333,6 +806,216 @@ void CodeGenerator::codegen_stmt(ASTNode *node) {
     }
 }
 
+llvm::Function* CodeGenerator::parallel_for_function() {
+    // void @__3cc_parallel_for(ptr body, ptr env, i64 count, ptr ops, ptr results)
+    // from runtime/parallel.c
+    if (llvm::Function *func = module->getFunction("__3cc_parallel_for")) {
+        return func;
+    }
+    llvm::Type *ptr = llvm::PointerType::getUnqual(*context);
+    llvm::FunctionType *func_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*context),
+        {ptr, ptr, llvm::Type::getInt64Ty(*context), ptr, ptr},
+        false
+    );
+    return llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
+                                  "__3cc_parallel_for", module.get());
+}
+
+// A parallel for (checked by check_parallel_loops) runs its body as a
+// separate function over ranges of iteration numbers, which the runtime
+// hands to its threads. The body gets the values it reads from here in an
+// environment array, and accumulates the reduction variables in an array
+// that starts with their values before the loop.
+void CodeGenerator::codegen_parallel_for(ASTNode *node) {
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*context);
+    llvm::Type *i64 = llvm::Type::getInt64Ty(*context);
+    ASTNode *condition = node->data.for_loop.condition;
+    std::string loop_variable = node->data.for_loop.init->data.assignment.name;
+    int64_t step = node->data.for_loop.increment->data.assignment.value->data.binary.right->data.number;
+
+    llvm::Value *start = codegen_expr(node->data.for_loop.init->data.assignment.value);
+    llvm::Value *bound = codegen_expr(condition->data.binary.right);
+    if (!start || !bound) return;
+
+    // Number of iterations, in 64 bits so that it cannot overflow
+    llvm::Value *start64 = builder->CreateSExt(start, i64);
+    llvm::Value *bound64 = builder->CreateSExt(bound, i64);
+    if (condition->data.binary.op == BinaryOp::OP_LE) {
+        bound64 = builder->CreateAdd(bound64, builder->getInt64(1));
+    }
+    llvm::Value *span = builder->CreateSub(bound64, start64);
+    llvm::Value *count = builder->CreateSelect(
+        builder->CreateICmpSGT(span, builder->getInt64(0)),
+        builder->CreateSDiv(builder->CreateAdd(span, builder->getInt64(step - 1)),
+                            builder->getInt64(step)),
+        builder->getInt64(0), "count");
+
+    std::vector<std::string> captured;
+    for (const auto &name : parallel_loop_variables(node)) {
+        if (!is_global_var(name)) captured.push_back(name);
+    }
+    std::vector<ReductionList*> reductions;
+    std::string ops;
+    for (ReductionList *r = node->data.for_loop.reductions; r; r = r->next) {
+        reductions.push_back(r);
+        ops += r->op == BinaryOp::OP_MUL ? '*' : '+';
+    }
+
+    llvm::BasicBlock *entry = &current_function->getEntryBlock();
+    llvm::IRBuilder<> entry_builder(entry, entry->begin());
+    llvm::Type *env_type = llvm::ArrayType::get(i32, captured.size() + 1);
+    llvm::Value *env = entry_builder.CreateAlloca(env_type, nullptr, "env");
+    llvm::Type *results_type = llvm::ArrayType::get(i32, reductions.size());
+    llvm::Value *results = entry_builder.CreateAlloca(results_type, nullptr, "results");
+
+    llvm::BasicBlock *block = builder->GetInsertBlock();
+    builder->CreateStore(start, builder->CreateConstInBoundsGEP2_32(env_type, env, 0, 0));
+    for (size_t j = 0; j < captured.size(); j++) {
+        builder->CreateStore(read_variable(captured[j], block),
+                             builder->CreateConstInBoundsGEP2_32(env_type, env, 0, j + 1));
+    }
+    for (size_t k = 0; k < reductions.size(); k++) {
+        builder->CreateStore(read_variable(reductions[k]->name, block),
+                             builder->CreateConstInBoundsGEP2_32(results_type, results, 0, k));
+    }
+
+    llvm::Function *body = codegen_parallel_body(node, captured);
+    if (freestanding) {
+        // The built-in runtime has no threads: one range with everything
+        builder->CreateCall(body, {env, builder->getInt64(0), count, results});
+    } else {
+        builder->CreateCall(parallel_for_function(),
+                            {body, env, count, builder->CreateGlobalString(ops, "reduce.ops"), results});
+    }
+
+    for (size_t k = 0; k < reductions.size(); k++) {
+        write_variable(reductions[k]->name, block, builder->CreateLoad(
+            i32, builder->CreateConstInBoundsGEP2_32(results_type, results, 0, k),
+            reductions[k]->name));
+    }
+    // The loop variable ends where the sequential loop would have left it
+    write_variable(loop_variable, block, builder->CreateAdd(
+        start, builder->CreateMul(builder->CreateTrunc(count, i32),
+                                  builder->getInt32(static_cast<int32_t>(step)))));
+}
+
+llvm::Function* CodeGenerator::codegen_parallel_body(ASTNode *node,
+                                                     const std::vector<std::string> &captured) {
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*context);
+    llvm::Type *i64 = llvm::Type::getInt64Ty(*context);
+    llvm::Type *ptr = llvm::PointerType::getUnqual(*context);
+    std::string loop_variable = node->data.for_loop.init->data.assignment.name;
+    int32_t step = node->data.for_loop.increment->data.assignment.value->data.binary.right->data.number;
+
+    // void body(ptr env, i64 begin, i64 end, ptr accumulators)
+    llvm::FunctionType *func_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*context), {ptr, i64, i64, ptr}, false);
+    llvm::Function *func = llvm::Function::Create(
+        func_type, llvm::Function::InternalLinkage,
+        current_function->getName() + ".parallel", module.get());
+    if (streaming) streamed_functions.push_back(func);
+    // Optimized like the function it is part of
+    if (current_function->hasFnAttribute(llvm::Attribute::OptimizeNone)) {
+        set_function_tier(func, OptTier::NONE);
+    } else if (current_function->hasFnAttribute(LIGHT_TIER_ATTRIBUTE)) {
+        set_function_tier(func, OptTier::LIGHT);
+    }
+    llvm::Value *env = func->getArg(0);
+    llvm::Value *begin = func->getArg(1);
+    llvm::Value *end = func->getArg(2);
+    llvm::Value *accumulators = func->getArg(3);
+    env->setName("env");
+    begin->setName("begin");
+    end->setName("end");
+    accumulators->setName("acc");
+    ++NumParallelLoops;
+
+    // Generated like a function of its own, in the middle of the current one
+    llvm::IRBuilderBase::InsertPointGuard insert_point(*builder);
+    auto prev_current_def = std::move(current_def);
+    auto prev_incomplete_phis = std::move(incomplete_phis);
+    auto prev_sealed_blocks = std::move(sealed_blocks);
+    auto prev_function = current_function;
+    current_function = func;
+    current_def.clear();
+    incomplete_phis.clear();
+    sealed_blocks.clear();
+
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(*context, "entry", func);
+    llvm::BasicBlock *loop_block = llvm::BasicBlock::Create(*context, "parloop", func);
+    llvm::BasicBlock *body_block = llvm::BasicBlock::Create(*context, "parbody", func);
+    llvm::BasicBlock *after_block = llvm::BasicBlock::Create(*context, "afterpar", func);
+    seal_block(entry);
+    builder->SetInsertPoint(entry);
+
+    llvm::Type *env_type = llvm::ArrayType::get(i32, captured.size() + 1);
+    llvm::Value *start = builder->CreateLoad(
+        i32, builder->CreateConstInBoundsGEP2_32(env_type, env, 0, 0), "start");
+    std::vector<llvm::Value*> captured_values;
+    for (size_t j = 0; j < captured.size(); j++) {
+        captured_values.push_back(builder->CreateLoad(
+            i32, builder->CreateConstInBoundsGEP2_32(env_type, env, 0, j + 1), captured[j]));
+    }
+
+    // Reductions start from the identity in each range
+    std::vector<ReductionList*> reductions;
+    for (ReductionList *r = node->data.for_loop.reductions; r; r = r->next) {
+        reductions.push_back(r);
+        write_variable(r->name, entry, builder->getInt32(r->op == BinaryOp::OP_MUL ? 1 : 0));
+    }
+    builder->CreateBr(loop_block);
+
+    builder->SetInsertPoint(loop_block);
+    llvm::PHINode *index = builder->CreatePHI(i64, 2, "index");
+    index->addIncoming(begin, entry);
+    builder->CreateCondBr(builder->CreateICmpSLT(index, end, "parcond"), body_block, after_block);
+    seal_block(body_block);
+    seal_block(after_block);
+
+    // Every iteration starts from the values before the loop
+    builder->SetInsertPoint(body_block);
+    for (size_t j = 0; j < captured.size(); j++) {
+        write_variable(captured[j], body_block, captured_values[j]);
+    }
+    write_variable(loop_variable, body_block, builder->CreateAdd(
+        start, builder->CreateMul(builder->CreateTrunc(index, i32), builder->getInt32(step)),
+        loop_variable));
+    codegen_stmt(node->data.for_loop.body);
+    index->addIncoming(builder->CreateAdd(index, builder->getInt64(1), "nextindex"),
+                       builder->GetInsertBlock());
+    builder->CreateBr(loop_block);
+    seal_block(loop_block);
+
+    builder->SetInsertPoint(after_block);
+    llvm::Type *acc_type = llvm::ArrayType::get(i32, reductions.size());
+    for (size_t k = 0; k < reductions.size(); k++) {
+        llvm::Value *slot = builder->CreateConstInBoundsGEP2_32(acc_type, accumulators, 0, k);
+        llvm::Value *total = builder->CreateLoad(i32, slot);
+        llvm::Value *value = read_variable(reductions[k]->name, after_block);
+        builder->CreateStore(reductions[k]->op == BinaryOp::OP_MUL ?
+                             builder->CreateMul(total, value) : builder->CreateAdd(total, value),
+                             slot);
+    }
+    builder->CreateRetVoid();
+
+    current_def.clear();
+    llvm::removeUnreachableBlocks(*func);
+
+    std::string verify_message;
+    llvm::raw_string_ostream verify_stream(verify_message);
+    if (llvm::verifyFunction(*func, &verify_stream)) {
+        report_error("Error in parallel loop of " + prev_function->getName().str() + ": " +
+                     verify_message);
+    }
+
+    current_def = std::move(prev_current_def);
+    incomplete_phis = std::move(prev_incomplete_phis);
+    sealed_blocks = std::move(prev_sealed_blocks);
+    current_function = prev_function;
+    return func;
+}
+
 void CodeGenerator::codegen_function_def(ASTNode *node) {
     std::string func_name = node->data.function_def.name;
     ParamList *params = node->data.function_def.params;
@@ -348,13 +1031,62 @@ void CodeGenerator::codegen_function_def(ASTNode *node) {
         false
     );
 
+    // A function called before its definition (when streaming) is already
+    // declared, and the definition fills in the declaration
+    llvm::Function *declared = module->getFunction(func_name);
+    if (declared && !declared->isDeclaration()) {
+        declared = nullptr;
+    } else if (declared && declared->getFunctionType() != func_type) {
+        report_error("Function " + func_name + " takes " + std::to_string(param_count) +
+                     " arguments, but is called with " + std::to_string(declared->arg_size()));
+        return;
+    }
+
+    // A memoized function keeps its name for the wrapper that callers
+    // (including its own recursive calls) see, and its body moves to an
+    // internal function
+    llvm::Function *wrapper = nullptr;
+    if (memoized_functions.count(func_name)) {
+        wrapper = declared ? declared : llvm::Function::Create(
+            func_type,
+            llvm::Function::ExternalLinkage,
+            func_name,
+            module.get()
+        );
+    }
+
     // Create function
-    llvm::Function *func = llvm::Function::Create(
+    llvm::Function *func = declared && !wrapper ? declared : llvm::Function::Create(
         func_type,
-        llvm::Function::ExternalLinkage,
-        func_name,
+        wrapper ? llvm::Function::InternalLinkage : llvm::Function::ExternalLinkage,
+        wrapper ? func_name + ".body" : func_name,
         module.get()
     );
+    if (streaming) {
+        streamed_functions.push_back(func);
+        if (wrapper) streamed_functions.push_back(wrapper);
+    }
+
+    // Performance hints go on the function that callers see
+    llvm::Function *callee = wrapper ? wrapper : func;
+    int qualifiers = node->data.function_def.qualifiers;
+    if (qualifiers & QUALIFIER_INLINE) callee->addFnAttr(llvm::Attribute::AlwaysInline);
+    if (qualifiers & QUALIFIER_NOINLINE) callee->addFnAttr(llvm::Attribute::NoInline);
+    if (qualifiers & QUALIFIER_HOT) callee->addFnAttr(llvm::Attribute::Hot);
+    if (qualifiers & QUALIFIER_COLD) callee->addFnAttr(llvm::Attribute::Cold);
+
+    auto tier = opt_tiers.find(func_name);
+    if (tier != opt_tiers.end()) {
+        set_function_tier(func, tier->second);
+        if (wrapper) set_function_tier(wrapper, tier->second);
+    }
+
+    // The hooks are inserted at the end of optimize_module, after
+    // inlining, so inlined calls are not counted separately
+    if (instrument_functions) {
+        callee->addFnAttr("instrument-function-entry-inlined", "__cyg_profile_func_enter");
+        callee->addFnAttr("instrument-function-exit-inlined", "__cyg_profile_func_exit");
+    }
 
     // Set parameter names
     ParamList *param = params;
@@ -365,173 +1097,606 @@ void CodeGenerator::codegen_function_def(ASTNode *node) {
         }
     }
 
-    // Create entry block
+    ++NumFunctionsGenerated;
+
+    // Create entry block; nothing branches to it, so it is sealed from the start
     llvm::BasicBlock *entry = llvm::BasicBlock::Create(*context, "entry", func);
     builder->SetInsertPoint(entry);
 
     // Save previous context
-    auto prev_named_values = named_values;
+    auto prev_current_def = std::move(current_def);
+    auto prev_incomplete_phis = std::move(incomplete_phis);
+    auto prev_sealed_blocks = std::move(sealed_blocks);
     auto prev_function = current_function;
-    auto prev_return_block = current_return_block;
-    auto prev_return_alloca = return_value_alloca;
 
     // Set current function context
     current_function = func;
-    named_values.clear();
-
-    // Create return block and alloca for return value
-    current_return_block = llvm::BasicBlock::Create(*context, "return", func);
-    return_value_alloca = create_entry_block_alloca(func, "retval");
-
-    // Initialize return value to 0
-    builder->CreateStore(llvm::ConstantInt::get(*context, llvm::APInt(32, 0, true)), return_value_alloca);
+    current_def.clear();
+    incomplete_phis.clear();
+    sealed_blocks.clear();
+    seal_block(entry);
 
-    // Allocate space for parameters and store their values
+    // Parameters are the initial definitions of their variables
     param = params;
     for (auto &arg : func->args()) {
         if (param) {
-            llvm::AllocaInst *alloca = create_entry_block_alloca(func, param->name);
-            builder->CreateStore(&arg, alloca);
-            named_values[param->name] = alloca;
+            write_variable(param->name, entry, &arg);
             param = param->next;
         }
     }
 
+    // Globals that only this function uses start at their initial value
+    for (const auto &[name, owner] : localized_globals) {
+        if (owner == func_name) {
+            write_variable(name, entry, llvm::ConstantInt::get(
+                *context, llvm::APInt(32, localized_values[name], true)));
+        }
+    }
+
     // Generate function body
     codegen_stmt(node->data.function_def.body);
 
-    // If we haven't branched to return block yet, do it now
+    // Falling off the end of a function returns 0
     if (!builder->GetInsertBlock()->getTerminator()) {
-        builder->CreateBr(current_return_block);
+        builder->CreateRet(llvm::ConstantInt::get(*context, llvm::APInt(32, 0, true)));
     }
 
-    // Generate return block
-    builder->SetInsertPoint(current_return_block);
-    llvm::Value *ret_val = builder->CreateLoad(llvm::Type::getInt32Ty(*context), return_value_alloca, "retval");
-    builder->CreateRet(ret_val);
+    // Drop the blocks that follow a return
+    current_def.clear();
+    llvm::removeUnreachableBlocks(*func);
 
     // Verify function
-    if (llvm::verifyFunction(*func, &llvm::errs())) {
-        std::cerr << "Error in function " << func_name << std::endl;
+    std::string verify_message;
+    llvm::raw_string_ostream verify_stream(verify_message);
+    if (llvm::verifyFunction(*func, &verify_stream)) {
+        report_error("Error in function " + func_name + ": " + verify_message);
+    }
+
+    if (wrapper) {
+        codegen_memo_wrapper(wrapper, func);
     }
 
     // Restore previous context
-    named_values = prev_named_values;
+    current_def = std::move(prev_current_def);
+    incomplete_phis = std::move(prev_incomplete_phis);
+    sealed_blocks = std::move(prev_sealed_blocks);
     current_function = prev_function;
-    current_return_block = prev_return_block;
-    return_value_alloca = prev_return_alloca;
 }
 
-void CodeGenerator::generate_program(ASTNode *root, GlobalVar *globals) {
-    // Create global variables
+void CodeGenerator::codegen_memo_wrapper(llvm::Function *wrapper, llvm::Function *body) {
+    // Direct-mapped cache: each entry holds one argument tuple and its
+    // result, and a colliding call simply replaces it
+    const uint64_t table_size = 1024;
+    const unsigned index_bits = 10;
+
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*context);
+    llvm::Type *i8 = llvm::Type::getInt8Ty(*context);
+    unsigned arg_count = wrapper->arg_size();
+    std::string name = wrapper->getName().str();
+
+    auto create_table = [&](llvm::Type *entry_type, const std::string &suffix) {
+        llvm::Type *table_type = llvm::ArrayType::get(entry_type, table_size);
+        return new llvm::GlobalVariable(*module, table_type, false,
+                                        llvm::GlobalValue::InternalLinkage,
+                                        llvm::Constant::getNullValue(table_type),
+                                        name + ".memo." + suffix);
+    };
+    llvm::Type *key_type = llvm::ArrayType::get(i32, arg_count);
+    llvm::Type *keys_type = llvm::ArrayType::get(key_type, table_size);
+    llvm::Type *valid_type = llvm::ArrayType::get(i8, table_size);
+    llvm::Type *results_type = llvm::ArrayType::get(i32, table_size);
+    llvm::GlobalVariable *keys = create_table(key_type, "keys");
+    llvm::GlobalVariable *valid = create_table(i8, "valid");
+    llvm::GlobalVariable *results = create_table(i32, "results");
+
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(*context, "entry", wrapper);
+    llvm::BasicBlock *hit_block = llvm::BasicBlock::Create(*context, "hit", wrapper);
+    llvm::BasicBlock *miss_block = llvm::BasicBlock::Create(*context, "miss", wrapper);
+    builder->SetInsertPoint(entry);
+
+    // Multiplicative hash of the arguments; the top bits select the entry
+    std::vector<llvm::Value*> args;
+    llvm::Value *hash = builder->getInt32(0);
+    for (auto &arg : wrapper->args()) {
+        arg.setName(body->getArg(arg.getArgNo())->getName());
+        args.push_back(&arg);
+        hash = builder->CreateMul(builder->CreateXor(hash, &arg), builder->getInt32(0x9e3779b1));
+    }
+    llvm::Value *index = builder->CreateZExt(
+        builder->CreateLShr(hash, 32 - index_bits), builder->getInt64Ty(), "index");
+
+    llvm::Value *zero = builder->getInt64(0);
+    llvm::Value *valid_ptr = builder->CreateInBoundsGEP(valid_type, valid, {zero, index});
+    llvm::Value *hit = builder->CreateICmpNE(builder->CreateLoad(i8, valid_ptr), builder->getInt8(0));
+    std::vector<llvm::Value*> key_ptrs;
+    for (unsigned i = 0; i < arg_count; i++) {
+        llvm::Value *key_ptr = builder->CreateInBoundsGEP(
+            keys_type, keys, {zero, index, builder->getInt64(i)});
+        key_ptrs.push_back(key_ptr);
+        hit = builder->CreateAnd(hit, builder->CreateICmpEQ(builder->CreateLoad(i32, key_ptr), args[i]));
+    }
+    llvm::Value *result_ptr = builder->CreateInBoundsGEP(results_type, results, {zero, index});
+    builder->CreateCondBr(hit, hit_block, miss_block);
+
+    builder->SetInsertPoint(hit_block);
+    builder->CreateRet(builder->CreateLoad(i32, result_ptr, "cached"));
+
+    // The body may call back into the wrapper and overwrite this entry, so
+    // the entry is only filled once the result is known
+    builder->SetInsertPoint(miss_block);
+    llvm::Value *result = builder->CreateCall(body, args, "result");
+    for (unsigned i = 0; i < arg_count; i++) {
+        builder->CreateStore(args[i], key_ptrs[i]);
+    }
+    builder->CreateStore(result, result_ptr);
+    builder->CreateStore(builder->getInt8(1), valid_ptr);
+    builder->CreateRet(result);
+
+    std::string verify_message;
+    llvm::raw_string_ostream verify_stream(verify_message);
+    if (llvm::verifyFunction(*wrapper, &verify_stream)) {
+        report_error("Error in memoization wrapper " + name + ": " + verify_message);
+    }
+}
+
+void CodeGenerator::declare_function(const std::string &name, int param_count) {
+    std::vector<llvm::Type*> param_types(param_count, llvm::Type::getInt32Ty(*context));
+    llvm::FunctionType *func_type = llvm::FunctionType::get(
+        llvm::Type::getInt32Ty(*context), param_types, false);
+    llvm::Function::Create(func_type, llvm::Function::ExternalLinkage, name, module.get());
+}
+
+void CodeGenerator::create_globals(GlobalVar *globals) {
     GlobalVar *global = globals;
     while (global) {
+        if (localized_globals.count(global->name)) {
+            localized_values[global->name] = global->value;
+            global = global->next;
+            continue;
+        }
+
+        bool constant = constant_globals.count(global->name) > 0;
         llvm::GlobalVariable *gv = new llvm::GlobalVariable(
             *module,
             llvm::Type::getInt32Ty(*context),
-            false,  // not constant
-            llvm::GlobalValue::ExternalLinkage,
-            llvm::ConstantInt::get(*context, llvm::APInt(32, global->value, true)),
+            constant,
+            constant ? llvm::GlobalValue::InternalLinkage : llvm::GlobalValue::ExternalLinkage,
+            external_globals ? nullptr :
+                llvm::ConstantInt::get(*context, llvm::APInt(32, global->value, true)),
             global->name
         );
         global_vars[global->name] = gv;
         global = global->next;
     }
+}
+
+void CodeGenerator::verify_module() {
+    std::string verify_message;
+    llvm::raw_string_ostream verify_stream(verify_message);
+    if (llvm::verifyModule(*module, &verify_stream)) {
+        report_error("Error in module: " + verify_message);
+    }
+}
+
+void CodeGenerator::generate_program(ASTNode *root, GlobalVar *globals) {
+    // Create global variables
+    create_globals(globals);
 
     // Generate code for all functions
     codegen_stmt(root);
 
-    // Verify module
-    if (llvm::verifyModule(*module, &llvm::errs())) {
-        std::cerr << "Error in module" << std::endl;
+    verify_module();
+}
+
+void CodeGenerator::generate_functions(const std::vector<ASTNode*> &defs, GlobalVar *globals) {
+    create_globals(globals);
+    for (ASTNode *def : defs) {
+        codegen_function_def(def);
     }
+    verify_module();
 }
 
-void CodeGenerator::output_ir(const std::string &filename) {
-    std::error_code ec;
-    llvm::raw_fd_ostream dest(filename, ec);
+std::string CodeGenerator::ir_string() const {
+    std::string ir;
+    llvm::raw_string_ostream stream(ir);
+    module->print(stream, nullptr);
+    stream.flush();
+    return ir;
+}
 
-    if (ec) {
-        std::cerr << "Could not open file: " << ec.message() << std::endl;
-        return;
+// The standard pipeline of -O2 and -O3, or of -Os and -Oz with a size level
+static llvm::OptimizationLevel pipeline_level(int opt_level, int size_level) {
+    if (size_level == 1) return llvm::OptimizationLevel::Os;
+    if (size_level >= 2) return llvm::OptimizationLevel::Oz;
+    return opt_level == 2 ? llvm::OptimizationLevel::O2 : llvm::OptimizationLevel::O3;
+}
+
+// optsize, and minsize for -Oz, are what make the passes and the backend
+// choose the smaller code. Not for optnone functions, which minsize
+// contradicts.
+static void add_size_attributes(llvm::Function &func, int size_level) {
+    if (size_level <= 0 || func.isDeclaration() || func.hasOptNone()) return;
+    func.addFnAttr(llvm::Attribute::OptimizeForSize);
+    if (size_level >= 2) func.addFnAttr(llvm::Attribute::MinSize);
+}
+
+void CodeGenerator::optimize_module(int opt_level, llvm::PassInstrumentationCallbacks *callbacks) {
+    // -O0: emit the IR exactly as generated, apart from instrumentation
+    if (opt_level <= 0 && !instrument_functions) return;
+
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+
+    // Passes only skip optnone functions when asked to by instrumentation
+    llvm::PassInstrumentationCallbacks own_callbacks;
+    if (!callbacks) callbacks = &own_callbacks;
+    llvm::OptNoneInstrumentation optnone(/*DebugLogging=*/false);
+    optnone.registerCallbacks(*callbacks);
+
+    // With a target selected, passes see its cost model (TTI) and the
+    // pipeline is tuned for it
+    llvm::PassBuilder pass_builder(target_machine.get(), llvm::PipelineTuningOptions(),
+                                   std::nullopt, callbacks);
+    pass_builder.registerModuleAnalyses(mam);
+    pass_builder.registerCGSCCAnalyses(cgam);
+    pass_builder.registerFunctionAnalyses(fam);
+    pass_builder.registerLoopAnalyses(lam);
+    pass_builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+    llvm::ModulePassManager mpm;
+    if (opt_level <= 0) {
+        // Only the instrumentation below
+    } else if (opt_level == 1) {
+        // -O1: a short function-local cleanup pipeline, after inlining
+        // only the functions declared inline
+        mpm.addPass(llvm::AlwaysInlinerPass());
+        llvm::FunctionPassManager fpm;
+        add_cleanup_passes(fpm);
+        mpm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
+    } else {
+        // -O2/-O3: LLVM's standard pipelines (inlining, loop passes, ...)
+        mpm = pass_builder.buildPerModuleDefaultPipeline(pipeline_level(opt_level, size_level));
+    }
+
+    if (instrument_functions) {
+        mpm.addPass(llvm::createModuleToFunctionPassAdaptor(
+            llvm::EntryExitInstrumenterPass(/*PostInlining=*/true)));
+    }
+
+    // Functions of the light tier sit out the pipeline as optnone (and
+    // stay out of their callers), then get the cleanup of -O1 on their own.
+    // They are looked up by name afterwards, in case the pipeline deleted any.
+    std::vector<std::string> light_functions;
+    std::set<std::string> were_noinline;
+    for (llvm::Function &func : *module) {
+        if (!func.hasFnAttribute(LIGHT_TIER_ATTRIBUTE)) continue;
+        func.removeFnAttr(LIGHT_TIER_ATTRIBUTE);
+        if (opt_level <= 0) continue;
+        light_functions.push_back(func.getName().str());
+        if (func.hasFnAttribute(llvm::Attribute::NoInline)) were_noinline.insert(func.getName().str());
+        func.addFnAttr(llvm::Attribute::OptimizeNone);
+        func.addFnAttr(llvm::Attribute::NoInline);
     }
+    if (opt_level > 0) {
+        for (llvm::Function &func : *module) {
+            add_size_attributes(func, size_level);
+        }
+    }
+
+    mpm.run(*module, mam);
+
+    if (light_functions.empty()) return;
+    llvm::FunctionPassManager cleanup;
+    add_cleanup_passes(cleanup);
+    for (const auto &name : light_functions) {
+        llvm::Function *func = module->getFunction(name);
+        if (!func) continue;
+        func->removeFnAttr(llvm::Attribute::OptimizeNone);
+        if (!were_noinline.count(name)) func->removeFnAttr(llvm::Attribute::NoInline);
+        if (func->isDeclaration()) continue;
+        add_size_attributes(*func, size_level);
+        fam.invalidate(*func, llvm::PreservedAnalyses::none());
+        cleanup.run(*func, fam);
+    }
+}
 
-    module->print(dest, nullptr);
+void CodeGenerator::start_streaming(int opt_level) {
+    streaming = true;
+    if (opt_level <= 0) return;
+
+    // -O1 cleans up each function as optimize_module would; -O2 and -O3
+    // run the function simplification part of LLVM's pipeline, which the
+    // full pipeline repeats after inlining
+    function_pipeline = std::make_unique<FunctionPipeline>(target_machine.get());
+    if (opt_level == 1) {
+        add_cleanup_passes(function_pipeline->fpm);
+    } else {
+        function_pipeline->fpm = function_pipeline->pass_builder.buildFunctionSimplificationPipeline(
+            pipeline_level(opt_level, size_level), llvm::ThinOrFullLTOPhase::None);
+    }
 }
 
-void CodeGenerator::optimize_module() {
-    // Create a function pass manager
-    llvm::legacy::FunctionPassManager fpm(module.get());
+void CodeGenerator::stream_globals(GlobalVar *globals) {
+    create_globals(globals);
+}
 
-    // Add optimization passes (similar to -O2/-O3)
-    fpm.add(llvm::createPromoteMemoryToRegisterPass());  // mem2reg: promote allocas to registers
-    fpm.add(llvm::createInstructionCombiningPass());     // Combine instructions
-    fpm.add(llvm::createReassociatePass());              // Reassociate expressions
-    fpm.add(llvm::createGVNPass());                      // Global Value Numbering (removes redundancy)
-    fpm.add(llvm::createCFGSimplificationPass());        // Simplify control flow graph
-    fpm.add(llvm::createDeadCodeEliminationPass());      // Remove dead code
+void CodeGenerator::stream_function(ASTNode *def) {
+    codegen_function_def(def);
+    for (llvm::Function *func : streamed_functions) {
+        if (!function_pipeline || func->isDeclaration() || has_errors()) continue;
+        add_size_attributes(*func, size_level);
+        function_pipeline->fpm.run(*func, function_pipeline->fam);
+        // Nothing is kept for functions that are done
+        function_pipeline->fam.clear(*func, func->getName());
+    }
+    streamed_functions.clear();
+}
 
-    fpm.doInitialization();
+void CodeGenerator::finish_streaming() {
+    function_pipeline.reset();
+    // Functions after the first error were not generated
+    if (has_errors()) return;
 
-    // Run the optimization passes on each function
-    for (auto &func : *module) {
-        fpm.run(func);
+    for (const auto &name : forward_declared) {
+        if (module->getFunction(name)->isDeclaration()) {
+            report_error("Unknown function referenced: " + name);
+        }
     }
+    verify_module();
+}
 
-    fpm.doFinalization();
+void CodeGenerator::write_bitcode(llvm::SmallVectorImpl<char> &buffer) const {
+    llvm::raw_svector_ostream stream(buffer);
+    llvm::WriteBitcodeToFile(*module, stream);
 }
 
-void CodeGenerator::output_object_file(const std::string &filename) {
-    // Initialize native target
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmParser();
-    llvm::InitializeNativeTargetAsmPrinter();
+bool CodeGenerator::load_bitcode(llvm::StringRef bitcode) {
+    auto loaded = llvm::parseBitcodeFile(llvm::MemoryBufferRef(bitcode, "3cc"), *context);
+    if (!loaded) {
+        report_error(llvm::toString(loaded.takeError()));
+        return false;
+    }
+    module = std::move(*loaded);
+    return true;
+}
 
-    auto target_triple_str = llvm::sys::getDefaultTargetTriple();
+bool CodeGenerator::set_target(const std::string &triple) {
+    auto target_triple_str = triple.empty() ? llvm::sys::getDefaultTargetTriple() : triple;
     llvm::Triple target_triple(target_triple_str);
-    module->setTargetTriple(target_triple);
+    if (!initialize_target(target_triple)) {
+        report_error("Target not supported by this build of 3cc: " + target_triple_str);
+        return false;
+    }
 
     std::string error;
     auto target = llvm::TargetRegistry::lookupTarget(target_triple_str, error);
 
     if (!target) {
-        std::cerr << error << std::endl;
-        return;
+        report_error(error);
+        return false;
     }
 
     auto cpu = "generic";
     auto features = "";
 
+    // Size optimization relies on the linker's --gc-sections, which can
+    // only drop whole sections
     llvm::TargetOptions opt;
-    auto target_machine = target->createTargetMachine(
-        target_triple, cpu, features, opt, llvm::Reloc::PIC_);
+    opt.FunctionSections = size_level > 0;
+    opt.DataSections = size_level > 0;
+    target_machine.reset(target->createTargetMachine(
+        target_triple, cpu, features, opt, llvm::Reloc::PIC_));
 
+    module->setTargetTriple(target_triple);
     module->setDataLayout(target_machine->createDataLayout());
+    return true;
+}
 
-    std::error_code ec;
-    llvm::raw_fd_ostream dest(filename, ec, llvm::sys::fs::OF_None);
+// The x86-64 levels of the x86-64 psABI from v2 on, with the bits each
+// needs in CPUID 1 ECX, CPUID 7 EBX, CPUID 0x80000001 ECX and XCR0 (the
+// register state the OS saves), those of the levels below included
+struct X86Level {
+    const char *cpu;
+    uint32_t leaf1_ecx;
+    uint32_t leaf7_ebx;
+    uint32_t extended_ecx;
+    uint32_t xcr0;
+};
+
+static const X86Level X86_LEVELS[] = {
+    // SSE3, SSSE3, CMPXCHG16B, SSE4.1, SSE4.2, POPCNT; LAHF/SAHF
+    {"x86-64-v2", 0x00982201, 0x00000000, 0x01, 0x00},
+    // + FMA, MOVBE, OSXSAVE, AVX, F16C; BMI1, AVX2, BMI2; LZCNT; SSE and AVX state
+    {"x86-64-v3", 0x38d83201, 0x00000128, 0x21, 0x06},
+    // + AVX512F, AVX512DQ, AVX512CD, AVX512BW, AVX512VL; opmask and ZMM state
+    {"x86-64-v4", 0x38d83201, 0xd0030128, 0x21, 0xe6},
+};
+
+llvm::Function* CodeGenerator::cpu_level_function() {
+    // i32 @__3cc_cpu_level(): the highest x86-64 level the CPU supports,
+    // 1 for the baseline. Ifunc resolvers run before relocations are
+    // applied, so this cannot call into libc.
+    if (llvm::Function *func = module->getFunction("__3cc_cpu_level")) {
+        return func;
+    }
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*context);
+    llvm::Function *func = llvm::Function::Create(
+        llvm::FunctionType::get(i32, false), llvm::Function::InternalLinkage,
+        "__3cc_cpu_level", module.get());
+    func->addFnAttr(llvm::Attribute::NoUnwind);
 
-    if (ec) {
-        std::cerr << "Could not open file: " << ec.message() << std::endl;
-        return;
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(*context, "entry", func);
+    llvm::BasicBlock *xsave = llvm::BasicBlock::Create(*context, "xsave", func);
+    llvm::BasicBlock *levels = llvm::BasicBlock::Create(*context, "levels", func);
+    llvm::IRBuilder<> b(entry);
+
+    llvm::FunctionType *cpuid_type = llvm::FunctionType::get(
+        llvm::StructType::get(*context, {i32, i32, i32, i32}), {i32, i32}, false);
+    llvm::InlineAsm *cpuid = llvm::InlineAsm::get(
+        cpuid_type, "cpuid", "={ax},={bx},={cx},={dx},{ax},{cx},~{dirflag},~{fpsr},~{flags}",
+        /*hasSideEffects=*/false);
+    // One register of a CPUID leaf, or 0 if the CPU does not have the leaf
+    auto read_cpuid = [&](uint32_t leaf, unsigned reg, llvm::Value *max_leaf) -> llvm::Value* {
+        llvm::Value *value = b.CreateExtractValue(
+            b.CreateCall(cpuid_type, cpuid, {b.getInt32(leaf), b.getInt32(0)}), reg);
+        if (!max_leaf) return value;
+        return b.CreateSelect(b.CreateICmpUGE(max_leaf, b.getInt32(leaf)), value, b.getInt32(0));
+    };
+    llvm::Value *max_leaf = read_cpuid(0, 0, nullptr);
+    llvm::Value *max_extended = read_cpuid(0x80000000, 0, nullptr);
+    llvm::Value *leaf1_ecx = read_cpuid(1, 2, max_leaf);
+    llvm::Value *leaf7_ebx = read_cpuid(7, 1, max_leaf);
+    llvm::Value *extended_ecx = read_cpuid(0x80000001, 2, max_extended);
+
+    // XGETBV faults unless the OS has enabled it (OSXSAVE)
+    llvm::Value *osxsave = b.CreateICmpNE(b.CreateAnd(leaf1_ecx, 1u << 27), b.getInt32(0));
+    b.CreateCondBr(osxsave, xsave, levels);
+
+    b.SetInsertPoint(xsave);
+    llvm::FunctionType *xgetbv_type = llvm::FunctionType::get(
+        llvm::StructType::get(*context, {i32, i32}), {i32}, false);
+    llvm::InlineAsm *xgetbv = llvm::InlineAsm::get(
+        xgetbv_type, "xgetbv", "={ax},={dx},{cx},~{dirflag},~{fpsr},~{flags}",
+        /*hasSideEffects=*/false);
+    llvm::Value *enabled = b.CreateExtractValue(b.CreateCall(xgetbv_type, xgetbv, {b.getInt32(0)}), 0);
+    b.CreateBr(levels);
+
+    b.SetInsertPoint(levels);
+    llvm::PHINode *xcr0 = b.CreatePHI(i32, 2, "xcr0");
+    xcr0->addIncoming(b.getInt32(0), entry);
+    xcr0->addIncoming(enabled, xsave);
+
+    llvm::Value *level = b.getInt32(1);
+    for (size_t i = 0; i < std::size(X86_LEVELS); i++) {
+        const X86Level &required = X86_LEVELS[i];
+        llvm::Value *supported = b.getTrue();
+        std::pair<llvm::Value*, uint32_t> bits[] = {
+            {leaf1_ecx, required.leaf1_ecx}, {leaf7_ebx, required.leaf7_ebx},
+            {extended_ecx, required.extended_ecx}, {xcr0, required.xcr0},
+        };
+        for (const auto &[value, mask] : bits) {
+            if (mask == 0) continue;
+            supported = b.CreateAnd(supported, b.CreateICmpEQ(b.CreateAnd(value, mask),
+                                                              b.getInt32(mask)));
+        }
+        level = b.CreateSelect(supported, b.getInt32(i + 2), level);
+    }
+    b.CreateRet(level);
+    return func;
+}
+
+bool CodeGenerator::multiversion_functions(const std::set<std::string> &names,
+                                           const std::vector<std::string> &cpus) {
+    const llvm::Triple &triple = target_machine->getTargetTriple();
+    if (triple.getArch() != llvm::Triple::x86_64 || !triple.isOSBinFormatELF()) {
+        report_error("Multiversioning needs an x86-64 ELF target, for its ifuncs: " + triple.str());
+        return false;
+    }
+
+    // Levels as 2..4, highest first
+    std::vector<int> levels;
+    for (const auto &cpu : cpus) {
+        auto found = std::find_if(std::begin(X86_LEVELS), std::end(X86_LEVELS),
+                                  [&](const X86Level &level) { return cpu == level.cpu; });
+        if (found == std::end(X86_LEVELS)) {
+            report_error("Unknown x86-64 level: " + cpu +
+                         " (expected x86-64-v2, x86-64-v3 or x86-64-v4)");
+            return false;
+        }
+        levels.push_back(static_cast<int>(found - std::begin(X86_LEVELS)) + 2);
+    }
+    std::sort(levels.begin(), levels.end(), std::greater<int>());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+
+    llvm::Type *ptr = llvm::PointerType::getUnqual(*context);
+    for (const auto &name : names) {
+        // A memoized function's code is in its body
+        llvm::Function *func = module->getFunction(name + ".body");
+        if (!func) func = module->getFunction(name);
+        if (!func || func->isDeclaration()) continue;
+
+        // The original becomes the baseline version, and its name the ifunc's
+        std::string versioned_name = func->getName().str();
+        llvm::GlobalValue::LinkageTypes linkage = func->getLinkage();
+        func->setName(versioned_name + ".default");
+        func->setLinkage(llvm::Function::InternalLinkage);
+
+        std::vector<std::pair<int, llvm::Function*>> versions;
+        for (int level : levels) {
+            const char *cpu = X86_LEVELS[level - 2].cpu;
+            llvm::ValueToValueMapTy value_map;
+            llvm::Function *clone = llvm::CloneFunction(func, value_map);
+            std::string suffix = cpu;
+            std::replace(suffix.begin(), suffix.end(), '-', '_');
+            clone->setName(versioned_name + "." + suffix);
+            clone->addFnAttr("target-cpu", cpu);
+            // Recursive calls stay in the clone
+            func->replaceUsesWithIf(clone, [&](llvm::Use &use) {
+                auto *inst = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+                return inst && inst->getFunction() == clone;
+            });
+            versions.push_back({level, clone});
+            ++NumFunctionVersions;
+        }
+
+        llvm::Function *resolver = llvm::Function::Create(
+            llvm::FunctionType::get(ptr, false), llvm::Function::InternalLinkage,
+            versioned_name + ".resolver", module.get());
+        llvm::GlobalIFunc *ifunc = llvm::GlobalIFunc::create(
+            func->getFunctionType(), 0, linkage, versioned_name, resolver, module.get());
+        func->replaceUsesWithIf(ifunc, [&](llvm::Use &use) {
+            auto *inst = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+            return !inst || inst->getFunction() != func;
+        });
+
+        builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", resolver));
+        llvm::Value *level = builder->CreateCall(cpu_level_function(), {}, "level");
+        llvm::Value *chosen = func;
+        for (auto version = versions.rbegin(); version != versions.rend(); ++version) {
+            chosen = builder->CreateSelect(
+                builder->CreateICmpSGE(level, builder->getInt32(version->first)),
+                version->second, chosen);
+        }
+        builder->CreateRet(chosen);
+    }
+
+    verify_module();
+    return !has_errors();
+}
+
+CostReport CodeGenerator::cost_report() {
+    if (!target_machine && !set_target("")) {
+        return CostReport();
+    }
+    return estimate_costs(*module, *target_machine);
+}
+
+bool CodeGenerator::emit_object(llvm::SmallVectorImpl<char> &buffer) {
+    if (!target_machine && !set_target("")) {
+        return false;
     }
 
+    if (freestanding) {
+        std::string runtime_error;
+        if (!link_runtime(*module, target_machine->getTargetTriple(), size_level >= 2,
+                          runtime_error)) {
+            report_error(runtime_error);
+            return false;
+        }
+    }
+
+    llvm::raw_svector_ostream dest(buffer);
+
     llvm::legacy::PassManager pass;
     auto file_type = llvm::CodeGenFileType::ObjectFile;
 
     if (target_machine->addPassesToEmitFile(pass, dest, nullptr, file_type)) {
-        std::cerr << "TargetMachine can't emit a file of this type" << std::endl;
-        return;
+        report_error("TargetMachine can't emit a file of this type");
+        return false;
     }
 
     pass.run(*module);
-    dest.flush();
-}
-
-// C-style interface
-extern "C" {
-    void codegen_program(ASTNode *root, GlobalVar *globals) {
-        // This is called from the C-style main
-        // We'll handle this differently in main.cpp
-    }
+    return true;
 }
@@ -2,54 +2,215 @@
 #define CODEGEN_H
 
 #include "ast.h"
+#include "cost.h"
 #include "symtab.h"
 
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/ADT/SmallVector.h>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
+
+namespace llvm {
+class PassInstrumentationCallbacks;
+class TargetMachine;
+class Triple;
+}
+
+// How much optimize_module spends on a function (set_opt_tiers)
+enum class OptTier {
+    NONE,    // Not optimized at all (optnone)
+    LIGHT,   // Only the function-local cleanup of -O1, after the pipeline
+    FULL,    // The whole pipeline of the optimization level
+};
 
 class CodeGenerator {
 private:
     std::unique_ptr<llvm::LLVMContext> context;
     std::unique_ptr<llvm::Module> module;
     std::unique_ptr<llvm::IRBuilder<>> builder;
+    std::unique_ptr<llvm::TargetMachine> target_machine;   // Set by set_target
 
-    std::map<std::string, llvm::AllocaInst*> named_values;
     std::map<std::string, llvm::GlobalVariable*> global_vars;
 
+    // Local variables are kept in SSA form as they are generated, with the
+    // on-the-fly construction of Braun et al., "Simple and Efficient
+    // Construction of Static Single Assignment Form" (CC 2013). Definitions
+    // are tracked per variable and block; a block is sealed once all of its
+    // predecessors are known, and reads in an unsealed block get a phi whose
+    // operands are filled in when it is sealed. The handles follow
+    // replaceAllUsesWith, so removing a trivial phi updates them too.
+    std::map<std::string, std::map<llvm::BasicBlock*, llvm::WeakTrackingVH>> current_def;
+    std::map<llvm::BasicBlock*, std::map<std::string, llvm::PHINode*>> incomplete_phis;
+    std::set<llvm::BasicBlock*> sealed_blocks;
+
     llvm::Function *current_function;
-    llvm::BasicBlock *current_return_block;
-    llvm::AllocaInst *return_value_alloca;
 
     llvm::Function *printf_func;
+    llvm::Function *print_func;   // Built-in runtime print, when freestanding
+
+    bool freestanding;
+    bool external_globals = false;   // See set_external_globals
+    bool instrument_functions = false;
+    int size_level = 0;   // See set_size_level
+
+    // Functions called through a cache of their results (--auto-memoize)
+    std::set<std::string> memoized_functions;
+
+    // Definitions not to generate (set_skipped_functions)
+    std::set<std::string> skipped_functions;
+
+    // See set_opt_tiers; functions not in it are optimized fully
+    std::map<std::string, OptTier> opt_tiers;
+
+    // See set_global_plan; initial values of the localized globals
+    std::set<std::string> constant_globals;
+    std::map<std::string, std::string> localized_globals;
+    std::map<std::string, int> localized_values;
 
+    // See start_streaming
+    struct FunctionPipeline;
+    std::unique_ptr<FunctionPipeline> function_pipeline;
+    bool streaming = false;
+    std::vector<llvm::Function*> streamed_functions;   // Generated, not yet optimized
+    std::set<std::string> forward_declared;
+
+    std::vector<std::string> diagnostics;
+
+    void report_error(const std::string &message);
     void create_printf_declaration();
-    llvm::AllocaInst* create_entry_block_alloca(llvm::Function *func, const std::string &var_name);
+    void create_print_declaration();
+    llvm::Value* print_format();
+
+    void write_variable(const std::string &name, llvm::BasicBlock *block, llvm::Value *value);
+    llvm::Value* read_variable(const std::string &name, llvm::BasicBlock *block);
+    llvm::Value* read_variable_recursive(const std::string &name, llvm::BasicBlock *block);
+    llvm::Value* add_phi_operands(const std::string &name, llvm::PHINode *phi);
+    llvm::Value* try_remove_trivial_phi(llvm::PHINode *phi);
+    void seal_block(llvm::BasicBlock *block);
+    void start_unreachable_block();
+    llvm::MDNode* branch_weights(BranchHint hint);
+    void branch_to(llvm::BasicBlock *target);
 
     llvm::Value* codegen_expr(ASTNode *node);
+    llvm::Value* codegen_logical(ASTNode *node);
+    llvm::Value* codegen_conditional(ASTNode *node);
     void codegen_stmt(ASTNode *node);
+    void codegen_parallel_for(ASTNode *node);
+    llvm::Function* codegen_parallel_body(ASTNode *node, const std::vector<std::string> &captured);
+    llvm::Function* parallel_for_function();
+    llvm::Function* cpu_level_function();
     void codegen_function_def(ASTNode *node);
+    void codegen_memo_wrapper(llvm::Function *wrapper, llvm::Function *body);
+    void set_function_tier(llvm::Function *func, OptTier tier);
 
     bool is_global_var(const std::string &name) const;
+    void create_globals(GlobalVar *globals);
+    void verify_module();
 
 public:
-    CodeGenerator();
-    ~CodeGenerator() = default;
+    // A freestanding generator calls the built-in runtime (runtime.h)
+    // instead of libc and links it into the emitted object
+    explicit CodeGenerator(bool freestanding = false);
+    ~CodeGenerator();
 
+    // Generate the named functions as a wrapper that looks calls up in a
+    // direct-mapped table of earlier results. Only sound for pure functions
+    // (analysis.h); must be set before generate_program.
+    void set_memoized_functions(const std::set<std::string> &names) { memoized_functions = names; }
+    // Do not generate these function definitions; nothing generated may
+    // call them. Must be set before generate_program.
+    void set_skipped_functions(const std::set<std::string> &names) { skipped_functions = names; }
+    // Emit the named globals as internal constants, and turn each global
+    // in localized into a local variable of the function it maps to,
+    // starting at the global's initial value. Only sound as decided by
+    // analyze_globals; must be set before generate_program.
+    void set_global_plan(const std::set<std::string> &constants,
+                         const std::map<std::string, std::string> &localized) {
+        constant_globals = constants;
+        localized_globals = localized;
+    }
+    // Optimize each named function only as much as its tier says, e.g.
+    // because it runs too rarely to pay for the time the full pipeline
+    // takes. Only takes effect when optimizing; must be set before
+    // generate_program.
+    void set_opt_tiers(const std::map<std::string, OptTier> &tiers) { opt_tiers = tiers; }
+    // Optimize for size instead of speed: 1 for -Os, 2 for -Oz. Functions
+    // are marked optsize (and minsize at -Oz) and get LLVM's Os/Oz
+    // pipeline when optimized at -O2 or above, and objects put each
+    // function and global in a section of its own, for the linker to drop
+    // when unused. At -Oz the built-in runtime is the unbuffered one
+    // (runtime.h). Must be set before set_target.
+    void set_size_level(int level) { size_level = level; }
+    // Call __cyg_profile_func_enter/exit on entry to and exit from every
+    // function that is not inlined (runtime/profile.c)
+    void set_instrument_functions(bool instrument) { instrument_functions = instrument; }
+    // Declare the program's globals instead of defining them, for code
+    // that works on storage owned by someone else (the tiered interpreter)
+    void set_external_globals(bool external) { external_globals = external; }
+    // Declare a function that is defined in another module, so that the
+    // code generated next can call it
+    void declare_function(const std::string &name, int param_count);
     void generate_program(ASTNode *root, GlobalVar *globals);
-    void optimize_module();
-    void output_ir(const std::string &filename);
-    void output_object_file(const std::string &filename);
-};
+    // Generate only the given function definitions, in order
+    void generate_functions(const std::vector<ASTNode*> &defs, GlobalVar *globals);
+    void optimize_module(int opt_level, llvm::PassInstrumentationCallbacks *callbacks = nullptr);
 
-// C-style interface for compatibility
-extern "C" {
-    void codegen_program(ASTNode *root, GlobalVar *globals);
-}
+    // Streaming generation, one top-level item at a time as the parser
+    // completes it. Calls to functions that are not defined yet declare
+    // them, and each function goes through the function pipeline of
+    // opt_level as soon as it is generated, so optimize_module has less
+    // left to do. Globals must be added before the functions that use
+    // them; call set_target first, if at all.
+    void start_streaming(int opt_level);
+    void stream_globals(GlobalVar *globals);
+    void stream_function(ASTNode *def);
+    // Report functions that were called but never defined
+    void finish_streaming();
+    const llvm::Module &get_module() const { return *module; }
+    std::string ir_string() const;
+
+    // Serialize the module, or replace it with a copy read back into this
+    // generator's own context. This is how a module is cloned for another
+    // thread, since an LLVMContext must only be used by one thread at a time.
+    void write_bitcode(llvm::SmallVectorImpl<char> &buffer) const;
+    bool load_bitcode(llvm::StringRef bitcode);
+
+    // Select the target that optimize_module tunes for and emit_object
+    // emits for (the default target triple if empty)
+    bool set_target(const std::string &triple);
+    // Replace each named function with a clone per x86-64 level in cpus
+    // (x86-64-v2, x86-64-v3, x86-64-v4), each tuned for that level, plus
+    // the original for older CPUs, behind an ifunc that picks the best one
+    // the CPU supports when the program is loaded. Needs an x86-64 ELF
+    // target; call after set_target and before optimize_module, so that
+    // each clone is optimized for its level.
+    bool multiversion_functions(const std::set<std::string> &names,
+                                const std::vector<std::string> &cpus);
+    bool emit_object(llvm::SmallVectorImpl<char> &buffer);
+    // Estimate what each function costs on the target (cost.h); call after
+    // optimize_module, like emit_object
+    CostReport cost_report();
+
+    const std::vector<std::string> &get_diagnostics() const { return diagnostics; }
+    bool has_errors() const { return !diagnostics.empty(); }
+
+    // Hand the module (and the context that owns it) over to the caller,
+    // e.g. for JIT compilation. The generator is unusable afterwards.
+    std::unique_ptr<llvm::Module> release_module() { return std::move(module); }
+    std::unique_ptr<llvm::LLVMContext> release_context() { return std::move(context); }
+};
 
-extern SymbolTable *global_symtab;
+// Register the backend for triple (or the host) with LLVM, and nothing
+// else. Safe to call from any thread; returns false if the backend is not
+// built into 3cc.
+bool initialize_target(const llvm::Triple &triple);
+bool initialize_native_target();
 
 #endif /* CODEGEN_H */
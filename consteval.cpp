@@ -0,0 +1,325 @@
+#include "consteval.h"
+#include "analysis.h"
+#include "bytecode.h"
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+
+// Each interpreted call is a native call of Interpreter::execute, whose
+// frame is about 300 bytes in an unoptimized build. 1000 calls deep stays
+// well within a 512 KiB stack, e.g. that of a worker thread calling
+// compile(); deeper calls are left to run at run time.
+static constexpr int CONSTEVAL_DEPTH_LIMIT = 1000;
+
+static void collect_pending(ASTNode *node, std::set<std::string> &pending) {
+    if (!node) return;
+
+    if (node->type == ASTNodeType::AST_GLOBAL_VAR &&
+        node->data.global_var.value->type != ASTNodeType::AST_NUMBER) {
+        pending.insert(node->data.global_var.name);
+    } else if (node->type == ASTNodeType::AST_SEQUENCE) {
+        collect_pending(node->data.sequence.first, pending);
+        collect_pending(node->data.sequence.second, pending);
+    }
+}
+
+namespace {
+
+class ConstantEvaluator {
+private:
+    std::vector<std::string> &remarks;
+    std::vector<std::string> &diagnostics;
+
+    std::map<std::string, FunctionInfo> functions;
+    BytecodeProgram program;
+    std::unique_ptr<Interpreter> interpreter;   // Null if there is no bytecode
+    std::map<std::string, int> function_index;
+    std::map<std::string, int> global_index;
+
+    // Initial values of globals; pending ones have an initializer that
+    // has not been evaluated yet
+    std::map<std::string, int32_t> global_values;
+    std::set<std::string> pending;
+
+    bool in_initializer = false;
+
+    bool reads_pending_global(const std::string &function, std::set<std::string> &visited) const;
+    std::optional<int32_t> call(ASTNode *node);
+    std::optional<int32_t> evaluate(ASTNode *node);
+    void fold(ASTNode *node);
+
+public:
+    ConstantEvaluator(ASTNode *root, std::vector<std::string> &remarks,
+                      std::vector<std::string> &diagnostics);
+
+    void evaluate_initializers(ASTNode *node);
+    void fold_bodies(ASTNode *node);
+};
+
+} // namespace
+
+ConstantEvaluator::ConstantEvaluator(ASTNode *root, std::vector<std::string> &remarks,
+                                     std::vector<std::string> &diagnostics)
+    : remarks(remarks), diagnostics(diagnostics) {
+    GlobalVar *globals = collect_global_vars(root);
+    functions = analyze_functions(root, globals);
+
+    // Programs that cannot be translated get no calls evaluated; codegen
+    // reports their errors
+    std::vector<std::string> bytecode_diagnostics;
+    if (compile_bytecode(root, globals, program, bytecode_diagnostics)) {
+        interpreter = std::make_unique<Interpreter>(program);
+        interpreter->set_step_limit(CONSTEVAL_STEP_BUDGET);
+        interpreter->set_depth_limit(CONSTEVAL_DEPTH_LIMIT);
+        for (size_t i = 0; i < program.functions.size(); i++) {
+            function_index[program.functions[i].name] = static_cast<int>(i);
+        }
+        for (size_t i = 0; i < program.global_names.size(); i++) {
+            global_index[program.global_names[i]] = static_cast<int>(i);
+        }
+    }
+
+    for (GlobalVar *global = globals; global; global = global->next) {
+        global_values[global->name] = global->value;
+    }
+    global_vars_free(globals);
+    collect_pending(root, pending);
+}
+
+bool ConstantEvaluator::reads_pending_global(const std::string &function,
+                                             std::set<std::string> &visited) const {
+    auto info = functions.find(function);
+    if (info == functions.end()) return false;
+
+    for (const auto &global : info->second.globals_read) {
+        if (pending.count(global)) return true;
+    }
+    for (const auto &callee : info->second.callees) {
+        if (visited.insert(callee).second && reads_pending_global(callee, visited)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Run a call to a pure function if all of its arguments are constant
+std::optional<int32_t> ConstantEvaluator::call(ASTNode *node) {
+    const char *name = node->data.function_call.name;
+    auto info = functions.find(name);
+    auto index = function_index.find(name);
+    if (!interpreter || info == functions.end() || !info->second.pure ||
+        index == function_index.end() ||
+        arg_list_count(node->data.function_call.args) != info->second.param_count) {
+        return std::nullopt;
+    }
+
+    std::vector<int32_t> args;
+    std::string description = std::string(name) + "(";
+    for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+        auto value = evaluate(arg->expr);
+        if (!value) return std::nullopt;
+        args.push_back(*value);
+        description += (args.size() > 1 ? ", " : "") + std::to_string(*value);
+    }
+    description += ")";
+
+    std::set<std::string> visited = {name};
+    if (reads_pending_global(name, visited)) {
+        return std::nullopt;
+    }
+
+    int32_t result;
+    if (!interpreter->call(index->second, args, result)) {
+        remarks.push_back("not evaluated at compile time: " + description + ": " +
+                          interpreter->failure_reason());
+        return std::nullopt;
+    }
+    remarks.push_back("evaluated at compile time: " + description + " = " +
+                      std::to_string(result));
+    return result;
+}
+
+// Only literals and arithmetic on them in function bodies; initializers
+// can also use other globals and call pure functions
+std::optional<int32_t> ConstantEvaluator::evaluate(ASTNode *node) {
+    switch (node->type) {
+        case ASTNodeType::AST_NUMBER:
+            return node->data.number;
+
+        case ASTNodeType::AST_VARIABLE: {
+            auto value = global_values.find(node->data.variable);
+            if (!in_initializer || value == global_values.end() || pending.count(value->first)) {
+                return std::nullopt;
+            }
+            return value->second;
+        }
+
+        case ASTNodeType::AST_FUNCTION_CALL:
+            if (!in_initializer) return std::nullopt;
+            return call(node);
+
+        case ASTNodeType::AST_CONDITIONAL: {
+            auto condition = evaluate(node->data.conditional.condition);
+            if (!condition) return std::nullopt;
+            return evaluate(*condition ? node->data.conditional.then_value
+                                       : node->data.conditional.else_value);
+        }
+
+        case ASTNodeType::AST_BINARY_OP: {
+            auto left = evaluate(node->data.binary.left);
+            if (left && node->data.binary.op == BinaryOp::OP_AND && *left == 0) return 0;
+            if (left && node->data.binary.op == BinaryOp::OP_OR && *left != 0) return 1;
+            auto right = left ? evaluate(node->data.binary.right) : std::nullopt;
+            if (!right) return std::nullopt;
+
+            // Wrapping arithmetic, like the generated code
+            uint32_t l = static_cast<uint32_t>(*left), r = static_cast<uint32_t>(*right);
+            switch (node->data.binary.op) {
+                case BinaryOp::OP_ADD: return static_cast<int32_t>(l + r);
+                case BinaryOp::OP_SUB: return static_cast<int32_t>(l - r);
+                case BinaryOp::OP_MUL: return static_cast<int32_t>(l * r);
+                case BinaryOp::OP_DIV:
+                    if (*right == 0 || (*left == INT32_MIN && *right == -1)) {
+                        return std::nullopt;
+                    }
+                    return *left / *right;
+                case BinaryOp::OP_LT: return *left < *right;
+                case BinaryOp::OP_GT: return *left > *right;
+                case BinaryOp::OP_LE: return *left <= *right;
+                case BinaryOp::OP_GE: return *left >= *right;
+                case BinaryOp::OP_EQ: return *left == *right;
+                case BinaryOp::OP_NE: return *left != *right;
+                case BinaryOp::OP_AND:
+                case BinaryOp::OP_OR: return *right != 0;
+            }
+            return std::nullopt;
+        }
+
+        default:
+            return std::nullopt;
+    }
+}
+
+void ConstantEvaluator::evaluate_initializers(ASTNode *node) {
+    if (!node) return;
+
+    if (node->type == ASTNodeType::AST_SEQUENCE) {
+        // Source order, so initializers can use the globals before them
+        evaluate_initializers(node->data.sequence.first);
+        evaluate_initializers(node->data.sequence.second);
+        return;
+    }
+    if (node->type != ASTNodeType::AST_GLOBAL_VAR ||
+        node->data.global_var.value->type == ASTNodeType::AST_NUMBER) {
+        return;
+    }
+
+    const char *name = node->data.global_var.name;
+    in_initializer = true;
+    auto value = evaluate(node->data.global_var.value);
+    in_initializer = false;
+    if (!value) {
+        diagnostics.push_back(std::string("Error: initializer of global ") + name +
+                              " is not a compile-time constant");
+        return;
+    }
+
+    ast_free(node->data.global_var.value);
+    node->data.global_var.value = ast_number(*value);
+    pending.erase(name);
+    global_values[name] = *value;
+    auto index = global_index.find(name);
+    if (index != global_index.end()) {
+        interpreter->globals[index->second] = *value;
+    }
+}
+
+void ConstantEvaluator::fold(ASTNode *node) {
+    if (!node) return;
+
+    switch (node->type) {
+        case ASTNodeType::AST_BINARY_OP:
+            fold(node->data.binary.left);
+            fold(node->data.binary.right);
+            break;
+        case ASTNodeType::AST_CONDITIONAL:
+            fold(node->data.conditional.condition);
+            fold(node->data.conditional.then_value);
+            fold(node->data.conditional.else_value);
+            break;
+        case ASTNodeType::AST_ASSIGNMENT:
+            fold(node->data.assignment.value);
+            break;
+        case ASTNodeType::AST_RETURN:
+            fold(node->data.return_value);
+            break;
+        case ASTNodeType::AST_SEQUENCE:
+            fold(node->data.sequence.first);
+            fold(node->data.sequence.second);
+            break;
+        case ASTNodeType::AST_WHILE:
+            fold(node->data.while_loop.condition);
+            fold(node->data.while_loop.body);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            fold(node->data.for_loop.init);
+            fold(node->data.for_loop.condition);
+            fold(node->data.for_loop.increment);
+            fold(node->data.for_loop.body);
+            break;
+        case ASTNodeType::AST_IF:
+            fold(node->data.if_stmt.condition);
+            fold(node->data.if_stmt.then_branch);
+            fold(node->data.if_stmt.else_branch);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            fold(node->data.switch_stmt.value);
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                fold(arm->body);
+            }
+            break;
+        case ASTNodeType::AST_PRINT:
+            fold(node->data.print_value);
+            break;
+        case ASTNodeType::AST_FUNCTION_CALL: {
+            // Innermost calls first, so their results can be arguments
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                fold(arg->expr);
+            }
+            auto value = call(node);
+            if (value) {
+                free(node->data.function_call.name);
+                arg_list_free(node->data.function_call.args);
+                node->type = ASTNodeType::AST_NUMBER;
+                node->data.number = *value;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void ConstantEvaluator::fold_bodies(ASTNode *node) {
+    if (!node) return;
+
+    if (node->type == ASTNodeType::AST_FUNCTION_DEF) {
+        fold(node->data.function_def.body);
+    } else if (node->type == ASTNodeType::AST_SEQUENCE) {
+        fold_bodies(node->data.sequence.first);
+        fold_bodies(node->data.sequence.second);
+    }
+}
+
+void evaluate_constants(ASTNode *root, bool fold_calls, std::vector<std::string> &remarks,
+                        std::vector<std::string> &diagnostics) {
+    ConstantEvaluator evaluator(root, remarks, diagnostics);
+    evaluator.evaluate_initializers(root);
+    if (fold_calls && diagnostics.empty()) {
+        evaluator.fold_bodies(root);
+    }
+}
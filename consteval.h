@@ -0,0 +1,23 @@
+#ifndef CONSTEVAL_H
+#define CONSTEVAL_H
+
+#include "ast.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Instructions the interpreter may run for compile-time evaluation, in
+// total for one program
+constexpr uint64_t CONSTEVAL_STEP_BUDGET = 10000000;
+
+// Evaluate constant expressions in the AST before code generation.
+// Global initializers must evaluate to constants, and are replaced with
+// their value; calls to pure functions in them are run in the bytecode
+// interpreter. With fold_calls, calls to pure functions whose arguments
+// are all constant are also replaced in function bodies. Calls that do
+// not finish within the budget are left alone, with a remark.
+void evaluate_constants(ASTNode *root, bool fold_calls, std::vector<std::string> &remarks,
+                        std::vector<std::string> &diagnostics);
+
+#endif /* CONSTEVAL_H */
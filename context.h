@@ -0,0 +1,43 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "ast.h"
+#include "symtab.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// All state belonging to a single compilation. The lexer, parser and
+// driver only ever reach program state through this object, so separate
+// compilations can run concurrently on different threads.
+struct CompileContext {
+    ASTNode *root;
+    SymbolTable *symtab;
+    std::vector<std::string> diagnostics;
+
+    // When set, the parser hands each top-level item (function definition
+    // or global declaration) to on_item as soon as it is complete, instead
+    // of adding it to root. on_item takes ownership of the item.
+    std::function<void(ASTNode *)> on_item;
+
+    CompileContext() : root(nullptr), symtab(symtab_create()) {}
+    ~CompileContext() {
+        ast_free(root);
+        symtab_free(symtab);
+    }
+
+    CompileContext(const CompileContext &) = delete;
+    CompileContext &operator=(const CompileContext &) = delete;
+};
+
+// Parse source into ctx->root using a private scanner instance.
+// Returns 0 on success (defined in lexer.l)
+int parse_program(CompileContext *ctx, const char *source);
+
+// Run only the scanner over source, for benchmarking it. Returns the
+// number of tokens, or -1 on an error (in ctx->diagnostics)
+long scan_tokens(CompileContext *ctx, const char *source, size_t length);
+
+#endif /* CONTEXT_H */
@@ -0,0 +1,236 @@
+#include "cost.h"
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/CodeGen/TargetSubtargetInfo.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace {
+
+// The execution resources instructions are charged to
+enum Resource {
+    ALU,
+    VECTOR,
+    LOAD,
+    STORE,
+    MULTIPLY,
+    DIVIDE,
+    BRANCH,   // Calls too
+    RESOURCE_COUNT,
+};
+
+// Cost of one run of a block, per resource
+struct BlockCost {
+    long instructions = 0;
+    double uops = 0;          // Instructions that cost anything
+    double pressure[RESOURCE_COUNT] = {};
+};
+
+}
+
+static const char *const RESOURCE_NAMES[RESOURCE_COUNT] = {
+    "alu", "vector", "load", "store", "multiply", "divide", "branch",
+};
+
+// Units per resource, roughly those of current x86-64 and AArch64 cores.
+// Scalar ALU instructions can use as many units as the CPU issues
+// instructions per cycle (0 here).
+static const unsigned RESOURCE_UNITS[RESOURCE_COUNT] = {0, 2, 2, 1, 1, 1, 1};
+
+static Resource resource_of(const llvm::Instruction &inst) {
+    if (llvm::isa<llvm::LoadInst>(inst)) return LOAD;
+    if (llvm::isa<llvm::StoreInst>(inst)) return STORE;
+    if (inst.isTerminator() ||
+        (llvm::isa<llvm::CallBase>(inst) && !llvm::isa<llvm::IntrinsicInst>(inst))) {
+        return BRANCH;
+    }
+    if (inst.getType()->isVectorTy()) return VECTOR;
+    switch (inst.getOpcode()) {
+        case llvm::Instruction::Mul:
+            return MULTIPLY;
+        case llvm::Instruction::SDiv:
+        case llvm::Instruction::UDiv:
+        case llvm::Instruction::SRem:
+        case llvm::Instruction::URem:
+            return DIVIDE;
+        default:
+            return ALU;
+    }
+}
+
+static BlockCost block_cost(const llvm::BasicBlock &block, const llvm::TargetTransformInfo &tti) {
+    BlockCost cost;
+    for (const llvm::Instruction &inst : block) {
+        cost.instructions++;
+        llvm::InstructionCost throughput =
+            tti.getInstructionCost(&inst, llvm::TargetTransformInfo::TCK_RecipThroughput);
+        if (!throughput.isValid() || throughput == 0) continue;
+        cost.uops++;
+        cost.pressure[resource_of(inst)] += static_cast<double>(throughput.getValue());
+    }
+    return cost;
+}
+
+// The cycles that running each block weight times take, limited by the
+// busiest resource or by issue_width
+static ThroughputEstimate combine(const std::vector<std::pair<const BlockCost*, double>> &blocks,
+                                  unsigned issue_width) {
+    ThroughputEstimate estimate;
+    double uops = 0;
+    double pressure[RESOURCE_COUNT] = {};
+    for (const auto &[cost, weight] : blocks) {
+        estimate.instructions += cost->instructions;
+        uops += cost->uops * weight;
+        for (int r = 0; r < RESOURCE_COUNT; r++) {
+            pressure[r] += cost->pressure[r] * weight;
+        }
+    }
+
+    estimate.cycles = uops / issue_width;
+    estimate.bound = "issue";
+    for (int r = 0; r < RESOURCE_COUNT; r++) {
+        if (pressure[r] == 0) continue;
+        double busy = pressure[r] / (RESOURCE_UNITS[r] ? RESOURCE_UNITS[r] : issue_width);
+        estimate.pressure[RESOURCE_NAMES[r]] = busy;
+        if (busy > estimate.cycles) {
+            estimate.cycles = busy;
+            estimate.bound = RESOURCE_NAMES[r];
+        }
+    }
+    return estimate;
+}
+
+static std::string block_name(const llvm::BasicBlock &block) {
+    std::string name;
+    llvm::raw_string_ostream stream(name);
+    block.printAsOperand(stream, /*PrintType=*/false);
+    stream.flush();
+    return name.substr(name.find_first_not_of('%'));
+}
+
+CostReport estimate_costs(llvm::Module &module, llvm::TargetMachine &target_machine) {
+    CostReport report;
+    report.triple = target_machine.getTargetTriple().str();
+    report.cpu = target_machine.getTargetCPU().str();
+    report.issue_width = target_machine.getMCSubtargetInfo()->getSchedModel().IssueWidth;
+
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::PassBuilder pass_builder(&target_machine);
+    pass_builder.registerModuleAnalyses(mam);
+    pass_builder.registerCGSCCAnalyses(cgam);
+    pass_builder.registerFunctionAnalyses(fam);
+    pass_builder.registerLoopAnalyses(lam);
+    pass_builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+    for (llvm::Function &func : module) {
+        if (func.isDeclaration()) continue;
+
+        // Functions cloned for another CPU (--multiversion) use its model
+        const llvm::TargetSubtargetInfo *subtarget = target_machine.getSubtargetImpl(func);
+        unsigned issue_width = subtarget ? subtarget->getSchedModel().IssueWidth : report.issue_width;
+        if (issue_width == 0) issue_width = 1;
+
+        const llvm::TargetTransformInfo &tti = fam.getResult<llvm::TargetIRAnalysis>(func);
+        const llvm::BlockFrequencyInfo &frequencies = fam.getResult<llvm::BlockFrequencyAnalysis>(func);
+        const llvm::LoopInfo &loops = fam.getResult<llvm::LoopAnalysis>(func);
+
+        std::map<const llvm::BasicBlock*, BlockCost> costs;
+        for (const llvm::BasicBlock &block : func) {
+            costs[&block] = block_cost(block, tti);
+        }
+        // How often block runs per run of reference
+        auto relative_frequency = [&](const llvm::BasicBlock *block, const llvm::BasicBlock *reference) {
+            double base = static_cast<double>(frequencies.getBlockFreq(reference).getFrequency());
+            return base > 0 ? frequencies.getBlockFreq(block).getFrequency() / base : 0.0;
+        };
+
+        FunctionCost function;
+        function.name = func.getName().str();
+        std::vector<std::pair<const BlockCost*, double>> weighted;
+        for (const llvm::BasicBlock &block : func) {
+            weighted.emplace_back(&costs[&block], relative_frequency(&block, &func.getEntryBlock()));
+        }
+        function.per_call = combine(weighted, issue_width);
+
+        for (const llvm::Loop *loop : loops.getLoopsInPreorder()) {
+            weighted.clear();
+            for (const llvm::BasicBlock *block : loop->blocks()) {
+                weighted.emplace_back(&costs[block], relative_frequency(block, loop->getHeader()));
+            }
+            function.loops.push_back({block_name(*loop->getHeader()),
+                                      static_cast<int>(loop->getLoopDepth()),
+                                      combine(weighted, issue_width)});
+        }
+        report.functions.push_back(std::move(function));
+    }
+    return report;
+}
+
+std::string format_cost_table(const CostReport &report) {
+    std::string out;
+    llvm::raw_string_ostream stream(out);
+    stream << "===== 3cc cost report: " << report.triple << ", " << report.cpu
+           << ", issue width " << report.issue_width << " =====\n\n";
+    stream << "Estimated cycles per call, or per iteration for loops, without callees\n\n";
+    stream << llvm::left_justify("function / loop", 40) << ' ' << llvm::right_justify("instrs", 8)
+           << ' ' << llvm::right_justify("cycles", 10) << "  bound\n";
+    for (const auto &function : report.functions) {
+        const ThroughputEstimate &call = function.per_call;
+        stream << llvm::format("%-40s %8ld %10.1f  %s\n", function.name.c_str(),
+                               call.instructions, call.cycles, call.bound.c_str());
+        for (const auto &loop : function.loops) {
+            std::string label = std::string(2 * loop.depth, ' ') + "loop " + loop.header;
+            const ThroughputEstimate &iteration = loop.per_iteration;
+            stream << llvm::format("%-40s %8ld %10.1f  %s\n", label.c_str(),
+                                   iteration.instructions, iteration.cycles, iteration.bound.c_str());
+        }
+    }
+    stream.flush();
+    return out;
+}
+
+static void write_estimate_json(llvm::raw_ostream &stream, const ThroughputEstimate &estimate) {
+    stream << llvm::format("\"instructions\": %ld, \"cycles\": %.2f, \"bound\": \"%s\", \"pressure\": {",
+                           estimate.instructions, estimate.cycles, estimate.bound.c_str());
+    const char *sep = "";
+    for (const auto &[resource, cycles] : estimate.pressure) {
+        stream << llvm::format("%s\"%s\": %.2f", sep, resource.c_str(), cycles);
+        sep = ", ";
+    }
+    stream << "}";
+}
+
+// Names are identifiers and block names, which need no escaping
+std::string format_cost_json(const CostReport &report) {
+    std::string out;
+    llvm::raw_string_ostream stream(out);
+    stream << "{\n  \"triple\": \"" << report.triple << "\",\n  \"cpu\": \"" << report.cpu
+           << "\",\n  \"issue_width\": " << report.issue_width << ",\n  \"functions\": [";
+    const char *sep = "\n";
+    for (const auto &function : report.functions) {
+        stream << sep << "    {\"name\": \"" << function.name << "\", ";
+        write_estimate_json(stream, function.per_call);
+        stream << ", \"loops\": [";
+        const char *loop_sep = "";
+        for (const auto &loop : function.loops) {
+            stream << loop_sep << "{\"header\": \"" << loop.header << "\", \"depth\": " << loop.depth << ", ";
+            write_estimate_json(stream, loop.per_iteration);
+            stream << "}";
+            loop_sep = ", ";
+        }
+        stream << "]}";
+        sep = ",\n";
+    }
+    stream << "\n  ]\n}\n";
+    stream.flush();
+    return out;
+}
@@ -0,0 +1,54 @@
+#ifndef COST_H
+#define COST_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+class TargetMachine;
+}
+
+// Static throughput estimate of a piece of code, in the manner of
+// llvm-mca's block reciprocal throughput: each instruction costs what the
+// target's cost model (TTI) says it costs in reciprocal throughput, on one
+// of a few execution resources, and the code takes as many cycles as its
+// busiest resource needs, or as issuing all of its instructions does.
+// Blocks are weighted by how often they run relative to the function entry
+// or loop header (BlockFrequencyInfo). Calls count as the call itself,
+// without the callee.
+struct ThroughputEstimate {
+    long instructions = 0;               // Static count, all blocks
+    double cycles = 0;
+    std::string bound;                   // Busiest resource, or "issue"
+    std::map<std::string, double> pressure;   // Cycles each resource is busy
+};
+
+struct LoopCost {
+    std::string header;       // Name of the loop's header block
+    int depth;                // 1 for outermost loops
+    ThroughputEstimate per_iteration;
+};
+
+struct FunctionCost {
+    std::string name;
+    ThroughputEstimate per_call;
+    std::vector<LoopCost> loops;   // Outer loops before the loops they contain
+};
+
+struct CostReport {
+    std::string triple;
+    std::string cpu;
+    unsigned issue_width = 0;      // From the CPU's scheduling model
+    std::vector<FunctionCost> functions;   // In module order
+};
+
+// Estimate the cost of every function defined in module, for the target
+// and CPU of target_machine. Meant for optimized code.
+CostReport estimate_costs(llvm::Module &module, llvm::TargetMachine &target_machine);
+
+std::string format_cost_table(const CostReport &report);
+std::string format_cost_json(const CostReport &report);
+
+#endif /* COST_H */
@@ -0,0 +1,767 @@
+#include "lib3cc.h"
+#include "analysis.h"
+#include "ast.h"
+#include "codegen.h"
+#include "consteval.h"
+#include "context.h"
+#include "runtime/parallel.h"
+#include <llvm/ExecutionEngine/Orc/AbsoluteSymbols.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Support/Error.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+JITHandle::JITHandle(std::unique_ptr<llvm::orc::LLJIT> jit) : jit(std::move(jit)) {}
+
+JITHandle::~JITHandle() = default;
+
+void *JITHandle::lookup(const std::string &name) const {
+    auto address = jit->lookup(name);
+    if (!address) {
+        llvm::consumeError(address.takeError());
+        return nullptr;
+    }
+    return address->toPtr<void *>();
+}
+
+int JITHandle::run_main() const {
+    auto main_func = reinterpret_cast<int (*)()>(lookup("main"));
+    if (!main_func) {
+        return -1;
+    }
+    return main_func();
+}
+
+static bool check_main_exists(ASTNode *node) {
+    if (!node) return false;
+
+    if (node->type == ASTNodeType::AST_FUNCTION_DEF) {
+        if (strcmp(node->data.function_def.name, "main") == 0) {
+            return true;
+        }
+    } else if (node->type == ASTNodeType::AST_SEQUENCE) {
+        return check_main_exists(node->data.sequence.first) ||
+               check_main_exists(node->data.sequence.second);
+    }
+
+    return false;
+}
+
+static std::unique_ptr<JITHandle> create_jit(CodeGenerator &codegen,
+                                             std::vector<std::string> &diagnostics) {
+    if (!initialize_native_target()) {
+        diagnostics.push_back("The host target is not supported by this build of 3cc");
+        return nullptr;
+    }
+
+    // LLJIT resolves symbols from the host process by default, which is
+    // where printf comes from
+    auto jit = llvm::orc::LLJITBuilder().create();
+    if (!jit) {
+        diagnostics.push_back(llvm::toString(jit.takeError()));
+        return nullptr;
+    }
+
+    // Parallel loops call the runtime linked into this process
+    llvm::orc::SymbolMap symbols;
+    symbols[(*jit)->mangleAndIntern("__3cc_parallel_for")] = llvm::orc::ExecutorSymbolDef(
+        llvm::orc::ExecutorAddr::fromPtr(&__3cc_parallel_for), llvm::JITSymbolFlags::Exported);
+    if (auto err = (*jit)->getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
+        diagnostics.push_back(llvm::toString(std::move(err)));
+        return nullptr;
+    }
+
+    auto module = codegen.release_module();
+    auto context = codegen.release_context();
+    llvm::orc::ThreadSafeModule thread_safe_module(std::move(module), std::move(context));
+
+    if (auto err = (*jit)->addIRModule(std::move(thread_safe_module))) {
+        diagnostics.push_back(llvm::toString(std::move(err)));
+        return nullptr;
+    }
+
+    return std::make_unique<JITHandle>(std::move(*jit));
+}
+
+// Memoization pays off for pure functions that recurse, where the cache
+// can cut exponential call trees down to one call per distinct argument
+// tuple; other pure functions would only pay for the lookup. The cache is
+// not safe to share between threads, so functions that parallel loops
+// call are not memoized.
+static std::set<std::string> select_memoized_functions(
+    const std::map<std::string, FunctionInfo> &functions, const std::set<std::string> &threaded,
+    CompileResult &result) {
+    std::set<std::string> memoized;
+    for (const auto &[name, info] : functions) {
+        if (!info.recursive) continue;
+
+        if (!info.pure) {
+            result.remarks.push_back("not memoized: " + name + " " + info.impure_reason);
+        } else if (info.param_count == 0) {
+            result.remarks.push_back("not memoized: " + name + " has no parameters");
+        } else if (threaded.count(name)) {
+            result.remarks.push_back("not memoized: " + name + " is called from a parallel loop");
+        } else {
+            result.remarks.push_back("memoized: " + name + " is pure and recursive");
+            result.stats.memoized.push_back(name);
+            memoized.insert(name);
+        }
+    }
+    return memoized;
+}
+
+// Hot functions are where a clone per x86-64 level pays for the code it
+// adds. Calls through an ifunc cannot be inlined, so functions declared
+// inline are left alone.
+static std::set<std::string> select_multiversioned_functions(
+    const std::map<std::string, int> &function_qualifiers, CompileResult &result) {
+    std::set<std::string> multiversioned;
+    for (const auto &[name, qualifiers] : function_qualifiers) {
+        if (!(qualifiers & QUALIFIER_HOT)) continue;
+
+        if (qualifiers & QUALIFIER_INLINE) {
+            result.remarks.push_back("not multiversioned: " + name + " is declared inline");
+        } else {
+            result.remarks.push_back("multiversioned: " + name + " is declared hot");
+            multiversioned.insert(name);
+        }
+    }
+    if (multiversioned.empty()) {
+        result.remarks.push_back("nothing to multiversion: no function is declared hot");
+    }
+    return multiversioned;
+}
+
+// Rough time optimize_module takes per AST node of a function, per tier,
+// measured at -O2 on a program of a thousand generated functions. Only
+// meant to weigh tiers against each other.
+static double estimated_opt_ms(OptTier tier, int size) {
+    switch (tier) {
+        case OptTier::NONE:  return size * 0.0005;
+        case OptTier::LIGHT: return size * 0.035;
+        case OptTier::FULL:  return size * 0.065;
+    }
+    return 0;
+}
+
+static const char *tier_name(OptTier tier) {
+    switch (tier) {
+        case OptTier::NONE:  return "optnone";
+        case OptTier::LIGHT: return "light";
+        case OptTier::FULL:  return "full";
+    }
+    return "";
+}
+
+// Spend optimization time where the program spends its run time: a
+// function with a loop, called from one (where it should be inlined) or
+// called often is optimized fully; one that runs at most once and has no
+// loop not at all; the rest are only cleaned up. Declared qualifiers
+// override this (inline and hot: full, cold: optnone). With a budget, the
+// functions with the least to gain drop a tier at a time until the
+// estimated time fits.
+static std::map<std::string, OptTier> select_opt_tiers(
+    const std::map<std::string, FunctionInfo> &functions, const std::set<std::string> &roots,
+    double budget_ms, CompileResult &result) {
+    auto profiles = profile_functions(functions, roots);
+    std::map<std::string, OptTier> tiers;
+    std::map<std::string, std::string> reasons;
+    std::vector<std::pair<double, std::string>> demotable;   // Gain, name
+    for (const auto &[name, info] : functions) {
+        const FunctionProfile &profile = profiles[name];
+        int qualifiers = info.def->data.function_def.qualifiers;
+        char calls[32];
+        snprintf(calls, sizeof calls, "%.0f", profile.calls);
+        reasons[name] = " (loop depth " + std::to_string(profile.loop_depth) + ", ~" + calls +
+                        " calls" + (profile.called_in_loop ? " from a loop, " : ", ") +
+                        std::to_string(profile.size) + " nodes)";
+
+        if (qualifiers & (QUALIFIER_INLINE | QUALIFIER_HOT)) {
+            tiers[name] = OptTier::FULL;
+            reasons[name] = std::string(" is declared ") +
+                            (qualifiers & QUALIFIER_INLINE ? "inline" : "hot");
+            continue;
+        }
+        if (qualifiers & QUALIFIER_COLD) {
+            tiers[name] = OptTier::NONE;
+            reasons[name] = " is declared cold";
+            continue;
+        }
+
+        if (profile.loop_depth > 0 || profile.called_in_loop || profile.calls >= 100) {
+            tiers[name] = OptTier::FULL;
+        } else if (profile.calls <= 1 && !info.recursive) {
+            tiers[name] = OptTier::NONE;
+        } else {
+            tiers[name] = OptTier::LIGHT;
+        }
+        demotable.push_back({profile.calls * std::pow(10.0, std::min(profile.loop_depth, 6)), name});
+    }
+
+    double full_ms = 0, estimated_ms = 0;
+    for (const auto &[name, tier] : tiers) {
+        full_ms += estimated_opt_ms(OptTier::FULL, profiles[name].size);
+        estimated_ms += estimated_opt_ms(tier, profiles[name].size);
+    }
+
+    // Least gain first; of equal gain, the largest first, since it saves most
+    std::sort(demotable.begin(), demotable.end(), [&](const auto &a, const auto &b) {
+        if (a.first != b.first) return a.first < b.first;
+        return profiles[a.second].size > profiles[b.second].size;
+    });
+    std::set<std::string> demoted;
+    for (OptTier from : {OptTier::FULL, OptTier::LIGHT}) {
+        for (const auto &[gain, name] : demotable) {
+            if (budget_ms <= 0 || estimated_ms <= budget_ms) break;
+            if (tiers[name] != from) continue;
+            OptTier to = from == OptTier::FULL ? OptTier::LIGHT : OptTier::NONE;
+            int size = profiles[name].size;
+            estimated_ms += estimated_opt_ms(to, size) - estimated_opt_ms(from, size);
+            tiers[name] = to;
+            demoted.insert(name);
+        }
+    }
+
+    int counts[3] = {0, 0, 0};
+    for (const auto &[name, tier] : tiers) {
+        result.remarks.push_back(std::string("opt tier ") + tier_name(tier) + ": " + name +
+                                 reasons[name]);
+        counts[static_cast<int>(tier)]++;
+    }
+    char summary[160];
+    snprintf(summary, sizeof summary,
+             "opt tiers: %d full, %d light, %d optnone; estimated %.1f ms of optimization "
+             "saved (%.1f ms instead of %.1f ms)",
+             counts[static_cast<int>(OptTier::FULL)], counts[static_cast<int>(OptTier::LIGHT)],
+             counts[static_cast<int>(OptTier::NONE)], full_ms - estimated_ms, estimated_ms,
+             full_ms);
+    result.remarks.push_back(summary);
+    if (budget_ms > 0) {
+        char budget[160];
+        snprintf(budget, sizeof budget, "opt budget of %.1f ms: %d functions demoted%s", budget_ms,
+                 static_cast<int>(demoted.size()), estimated_ms > budget_ms ? ", and still over it" : "");
+        result.remarks.push_back(budget);
+    }
+    return tiers;
+}
+
+// The level of the pipeline that fully optimized functions get: adaptive
+// optimization pays for -O2 by optimizing the rest less
+static int pipeline_opt_level(const CompileOptions &options) {
+    return options.adaptive_opt && options.opt_level == 1 ? 2 : options.opt_level;
+}
+
+// Once optimization has taken budget_ms, skip the optional passes that are
+// left (required ones, like the inliner for functions declared inline,
+// still run), counting them in skipped
+static void enforce_opt_budget(llvm::PassInstrumentationCallbacks &callbacks, double budget_ms,
+                               long &skipped) {
+    auto start = std::chrono::steady_clock::now();
+    callbacks.registerShouldRunOptionalPassCallback([=, &skipped](llvm::StringRef, llvm::Any) {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() <= budget_ms) return true;
+        skipped++;
+        return false;
+    });
+}
+
+static void report_skipped_passes(double budget_ms, long skipped, CompileResult &result) {
+    if (skipped == 0) return;
+    char remark[120];
+    snprintf(remark, sizeof remark, "opt budget of %.1f ms ran out: skipped %ld pass runs",
+             budget_ms, skipped);
+    result.remarks.push_back(remark);
+}
+
+static std::string format_callgraph(const std::map<std::string, FunctionInfo> &functions,
+                                    const std::set<std::string> &reachable) {
+    std::string out;
+    for (const auto &[name, info] : functions) {
+        out += name;
+        const char *separator = " -> ";
+        for (const auto &callee : info.callees) {
+            out += separator + callee;
+            separator = ", ";
+        }
+        if (!reachable.count(name)) {
+            out += " (unreachable)";
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+// Functions that main and the exports cannot reach are not generated, and
+// are left out of the analyses that follow
+static void skip_unreachable_functions(CodeGenerator &codegen,
+                                       std::map<std::string, FunctionInfo> &functions,
+                                       const std::set<std::string> &reachable,
+                                       CompileResult &result) {
+    std::set<std::string> skipped;
+    std::string names;
+    for (auto it = functions.begin(); it != functions.end();) {
+        if (reachable.count(it->first)) {
+            ++it;
+            continue;
+        }
+        names += (skipped.empty() ? "" : ", ") + it->first;
+        skipped.insert(it->first);
+        it = functions.erase(it);
+    }
+    if (skipped.empty()) return;
+
+    result.remarks.push_back("skipped " + std::to_string(skipped.size()) +
+                             " unreachable functions: " + names);
+    result.stats.functions_skipped = static_cast<long>(skipped.size());
+    codegen.set_skipped_functions(skipped);
+}
+
+// Globals that nothing assigns become constants the optimizer can fold,
+// and globals private to one function become its locals, which SSA
+// construction keeps in registers
+static void plan_globals(CodeGenerator &codegen, GlobalVar *globals,
+                         const std::map<std::string, FunctionInfo> &functions,
+                         CompileResult &result) {
+    std::set<std::string> constants;
+    std::map<std::string, std::string> localized;
+    for (const auto &[name, global] : analyze_globals(globals, functions)) {
+        if (global.read_only) {
+            result.remarks.push_back("global " + name + " is never assigned: emitted as a constant");
+            constants.insert(name);
+        } else if (!global.owner.empty()) {
+            result.remarks.push_back("global " + name + " is only used by " + global.owner +
+                                     ": made a local variable");
+            localized[name] = global.owner;
+        } else if (!global.shared_reason.empty()) {
+            result.remarks.push_back("global " + name + " is only used by " +
+                                     *global.users.begin() + ", but stays global: " +
+                                     global.shared_reason);
+        }
+    }
+    codegen.set_global_plan(constants, localized);
+}
+
+// Optimize and emit the generated module for each of several targets.
+// Every target gets its own copy of the module in its own LLVMContext, so
+// the targets are built in parallel without sharing any LLVM state.
+static void build_targets(CodeGenerator &codegen, const CompileOptions &options,
+                          const std::set<std::string> &multiversioned, CompileResult &result) {
+    llvm::SmallVector<char, 0> bitcode;
+    codegen.write_bitcode(bitcode);
+    llvm::StringRef bitcode_ref(bitcode.data(), bitcode.size());
+
+    size_t count = options.target_triples.size();
+    result.targets.resize(count);
+    std::vector<std::vector<std::string>> diagnostics(count);
+    std::vector<long> skipped_passes(count);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < count; i++) {
+        threads.emplace_back([&, i] {
+            TargetOutput &output = result.targets[i];
+            output.triple = options.target_triples[i];
+
+            CodeGenerator target_codegen(options.freestanding);
+            target_codegen.set_size_level(options.size_level);
+            if (target_codegen.load_bitcode(bitcode_ref) &&
+                target_codegen.set_target(output.triple) &&
+                (options.multiversion.empty() ||
+                 target_codegen.multiversion_functions(multiversioned, options.multiversion))) {
+                llvm::PassInstrumentationCallbacks callbacks;
+                if (options.adaptive_opt && options.opt_budget_ms > 0) {
+                    enforce_opt_budget(callbacks, options.opt_budget_ms, skipped_passes[i]);
+                }
+                target_codegen.optimize_module(pipeline_opt_level(options), &callbacks);
+                if (options.emit_ir) {
+                    output.ir = target_codegen.ir_string();
+                }
+                if (options.cost_report) {
+                    output.cost_report = target_codegen.cost_report();
+                }
+
+                llvm::SmallVector<char, 0> buffer;
+                if (target_codegen.emit_object(buffer)) {
+                    output.object.assign(buffer.begin(), buffer.end());
+                }
+            }
+            diagnostics[i] = target_codegen.get_diagnostics();
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        for (const auto &message : diagnostics[i]) {
+            result.diagnostics.push_back(options.target_triples[i] + ": " + message);
+        }
+        report_skipped_passes(options.opt_budget_ms, skipped_passes[i], result);
+    }
+}
+
+// Streaming compilation (CompileOptions::streaming): the parser hands over
+// each top-level item as soon as it is complete, which is generated (and
+// run through the function pipeline) right away and then freed. Global
+// initializers are evaluated with the globals before them. Parallel loops
+// are checked at the end, against summaries of the functions they call;
+// only the functions that have such loops keep their AST until then.
+static bool generate_streaming(const std::string &source, const CompileOptions &options,
+                               CodeGenerator &codegen, std::set<std::string> &multiversioned,
+                               CompileResult &result) {
+    if (options.auto_memoize) {
+        result.diagnostics.push_back("Error: --auto-memoize needs the whole program, "
+                                     "which streaming does not keep");
+        return false;
+    }
+    if (options.adaptive_opt) {
+        result.diagnostics.push_back("Error: adaptive optimization needs the whole call graph, "
+                                     "which streaming does not keep");
+        return false;
+    }
+
+    // The function pipeline sees the target's cost model, as optimize_module does
+    if (options.output == CompileOutput::OBJECT && options.target_triples.size() <= 1) {
+        codegen.set_target(options.target_triples.empty() ? "" : options.target_triples[0]);
+    }
+    codegen.start_streaming(options.opt_level);
+
+    ASTNode *global_decls = nullptr;      // Evaluated, in source order
+    GlobalVar *globals = nullptr;
+    std::set<std::string> global_names;
+    std::map<std::string, std::string> variable_users;   // First function using each name
+    std::map<std::string, FunctionInfo> functions;       // def only set for kept functions
+    std::map<std::string, int> qualifiers;
+    std::vector<ASTNode*> kept;
+
+    CompileContext ctx;
+    ctx.on_item = [&](ASTNode *item) {
+        if (options.stats) {
+            count_ast_nodes(item, result.stats);
+        }
+        if (!ctx.diagnostics.empty() || !result.diagnostics.empty() || codegen.has_errors()) {
+            ast_free(item);
+            return;
+        }
+
+        if (item->type == ASTNodeType::AST_GLOBAL_VAR) {
+            // Whole-program compilation sees every global before any function
+            std::string name = item->data.global_var.name;
+            auto user = variable_users.find(name);
+            if (user != variable_users.end()) {
+                result.diagnostics.push_back("Error: global " + name + " is declared after " +
+                                             user->second + ", which uses it; streaming "
+                                             "needs globals declared before their users");
+            }
+            global_decls = global_decls ? ast_sequence(global_decls, item) : item;
+            if (item->data.global_var.value->type != ASTNodeType::AST_NUMBER) {
+                evaluate_constants(global_decls, false, result.remarks, result.diagnostics);
+            }
+            GlobalVar *global = collect_global_vars(item);
+            codegen.stream_globals(global);
+            global->next = globals;
+            globals = global;
+            global_names.insert(name);
+            return;
+        }
+
+        // The rest of check_parallel_loops needs the whole program
+        if (!check_parallel_loop_headers(item, globals, result.diagnostics)) {
+            ast_free(item);
+            return;
+        }
+
+        std::string name = item->data.function_def.name;
+        for (const auto &variable : function_variables(item)) {
+            if (!global_names.count(variable)) variable_users.emplace(variable, name);
+        }
+        qualifiers[name] = item->data.function_def.qualifiers;
+        if (options.opt_level > 0) {
+            convert_if_chains(item, result.remarks);
+        }
+        functions[name] = analyze_functions(item, globals)[name];
+        codegen.stream_function(item);
+        if (has_parallel_loops(item)) {
+            kept.push_back(item);
+        } else {
+            functions[name].def = nullptr;
+            ast_free(item);
+        }
+    };
+
+    bool parsed = parse_program(&ctx, source.c_str()) == 0;
+    result.diagnostics.insert(result.diagnostics.end(),
+                              ctx.diagnostics.begin(), ctx.diagnostics.end());
+    if (parsed && result.diagnostics.empty()) {
+        if (!functions.count("main")) {
+            result.diagnostics.push_back("Error: main() function is required");
+        }
+        for (const auto &name : options.exports) {
+            if (!functions.count(name)) {
+                result.diagnostics.push_back("Error: exported function " + name + " is not defined");
+            }
+        }
+        check_parallel_loops(functions, globals, result.diagnostics);
+        if (!options.multiversion.empty()) {
+            multiversioned = select_multiversioned_functions(qualifiers, result);
+        }
+        if (options.callgraph) {
+            std::set<std::string> roots(options.exports.begin(), options.exports.end());
+            roots.insert("main");
+            result.callgraph = format_callgraph(functions, reachable_functions(functions, roots));
+        }
+        codegen.finish_streaming();
+    }
+
+    for (ASTNode *def : kept) {
+        ast_free(def);
+    }
+    ast_free(global_decls);
+    global_vars_free(globals);
+    return result.diagnostics.empty();
+}
+
+// Optimize the generated module, and emit it as the options ask
+static void optimize_and_emit(CodeGenerator &codegen, const CompileOptions &options,
+                              const std::set<std::string> &multiversioned, CompileResult &result,
+                              std::chrono::steady_clock::time_point &phase_start) {
+    CompileStats &stats = result.stats;
+    if (codegen.has_errors()) {
+        // Nothing to optimize or emit
+    } else if (options.target_triples.size() > 1) {
+        if (options.output == CompileOutput::JIT) {
+            result.diagnostics.push_back("JIT output is only possible for the host target");
+        } else {
+            build_targets(codegen, options, multiversioned, result);
+            if (options.stats) {
+                record_phase(stats, "targets", phase_start);
+                collect_llvm_statistics(stats);
+            }
+        }
+    } else if (options.output == CompileOutput::OBJECT &&
+               !codegen.set_target(options.target_triples.empty() ? "" : options.target_triples[0])) {
+        // Reported by set_target; emit_object would fall back to the host
+    } else {
+        if (!options.multiversion.empty()) {
+            codegen.multiversion_functions(multiversioned, options.multiversion);
+        }
+
+        // Run LLVM optimization passes
+        llvm::PassInstrumentationCallbacks callbacks;
+        if (options.stats) {
+            register_pass_stats(callbacks, codegen.get_module(), stats);
+        }
+        long skipped_passes = 0;
+        if (options.adaptive_opt && options.opt_budget_ms > 0) {
+            enforce_opt_budget(callbacks, options.opt_budget_ms, skipped_passes);
+        }
+        codegen.optimize_module(pipeline_opt_level(options), &callbacks);
+        report_skipped_passes(options.opt_budget_ms, skipped_passes, result);
+
+        if (options.stats) {
+            record_phase(stats, "optimize", phase_start);
+            stats.ir_optimized = count_ir(codegen.get_module());
+        }
+
+        if (options.emit_ir) {
+            result.ir = codegen.ir_string();
+        }
+        if (options.cost_report) {
+            result.cost_report = codegen.cost_report();
+            if (options.stats) {
+                record_phase(stats, "cost report", phase_start);
+            }
+        }
+
+        if (options.output == CompileOutput::JIT) {
+            result.jit = create_jit(codegen, result.diagnostics);
+        } else {
+            llvm::SmallVector<char, 0> buffer;
+            if (codegen.emit_object(buffer)) {
+                result.object.assign(buffer.begin(), buffer.end());
+            }
+        }
+
+        if (options.stats) {
+            record_phase(stats, "emit", phase_start);
+            collect_llvm_statistics(stats);
+        }
+    }
+
+    const auto &codegen_diagnostics = codegen.get_diagnostics();
+    result.diagnostics.insert(result.diagnostics.end(),
+                              codegen_diagnostics.begin(), codegen_diagnostics.end());
+    result.success = result.diagnostics.empty();
+}
+
+CompileResult compile(const std::string &source, const CompileOptions &options) {
+    CompileResult result;
+    CompileStats &stats = result.stats;
+
+    // LLVM's statistics are process-wide: a compile that reports them
+    // runs alone (stats.h)
+    std::unique_lock<std::shared_mutex> statistics_owner;
+    std::shared_lock<std::shared_mutex> statistics_user;
+    if (options.stats) {
+        statistics_owner = exclusive_statistics();
+        enable_llvm_statistics();
+    } else {
+        statistics_user = shared_statistics();
+    }
+    auto phase_start = std::chrono::steady_clock::now();
+
+    if (options.instrument_functions && options.freestanding) {
+        result.diagnostics.push_back("Error: function instrumentation needs libc and the "
+                                     "profiling runtime, not the built-in runtime");
+        return result;
+    }
+    if (!options.multiversion.empty() && options.output == CompileOutput::JIT) {
+        result.diagnostics.push_back("Error: multiversioning is only available for object files");
+        return result;
+    }
+    if (options.cost_report && options.output == CompileOutput::JIT) {
+        result.diagnostics.push_back("Error: the cost report is only available for object files");
+        return result;
+    }
+    if (!options.multiversion.empty() && options.freestanding) {
+        result.diagnostics.push_back("Error: multiversioning needs libc to resolve its ifuncs, "
+                                     "not the built-in runtime");
+        return result;
+    }
+
+    if (options.streaming) {
+        CodeGenerator codegen(options.freestanding);
+        codegen.set_instrument_functions(options.instrument_functions);
+        codegen.set_size_level(options.size_level);
+        std::set<std::string> multiversioned;
+        if (generate_streaming(source, options, codegen, multiversioned, result)) {
+            if (options.stats) {
+                record_phase(stats, "stream", phase_start);
+            }
+            optimize_and_emit(codegen, options, multiversioned, result, phase_start);
+        }
+        return result;
+    }
+
+    CompileContext ctx;
+    if (parse_program(&ctx, source.c_str()) != 0) {
+        result.diagnostics = std::move(ctx.diagnostics);
+        return result;
+    }
+
+    if (!check_main_exists(ctx.root)) {
+        result.diagnostics.push_back("Error: main() function is required");
+        return result;
+    }
+
+    if (options.stats) {
+        record_phase(stats, "parse", phase_start);
+        count_ast_nodes(ctx.root, stats);
+    }
+
+    // Global initializers are always evaluated; calls in function bodies
+    // only when optimizing
+    evaluate_constants(ctx.root, options.opt_level > 0, result.remarks, result.diagnostics);
+    if (!result.diagnostics.empty()) {
+        return result;
+    }
+    if (options.stats) {
+        record_phase(stats, "consteval", phase_start);
+    }
+    if (options.opt_level > 0) {
+        convert_if_chains(ctx.root, result.remarks);
+    }
+
+    // Collect global variables
+    GlobalVar *globals = collect_global_vars(ctx.root);
+
+    // Generate code using LLVM
+    CodeGenerator codegen(options.freestanding);
+    codegen.set_instrument_functions(options.instrument_functions);
+    codegen.set_size_level(options.size_level);
+    auto functions = analyze_functions(ctx.root, globals);
+    auto threaded = check_parallel_loops(functions, globals, result.diagnostics);
+
+    std::set<std::string> roots = {"main"};
+    for (const auto &name : options.exports) {
+        if (!functions.count(name)) {
+            result.diagnostics.push_back("Error: exported function " + name + " is not defined");
+        }
+        roots.insert(name);
+    }
+    if (!result.diagnostics.empty()) {
+        global_vars_free(globals);
+        return result;
+    }
+
+    auto reachable = reachable_functions(functions, roots);
+    if (options.callgraph) {
+        result.callgraph = format_callgraph(functions, reachable);
+    }
+    if (options.opt_level > 0) {
+        skip_unreachable_functions(codegen, functions, reachable, result);
+    }
+
+    if (options.auto_memoize) {
+        codegen.set_memoized_functions(select_memoized_functions(functions, threaded, result));
+    }
+    if (options.opt_level > 0) {
+        plan_globals(codegen, globals, functions, result);
+    }
+    if (options.opt_level > 0 && options.adaptive_opt) {
+        codegen.set_opt_tiers(select_opt_tiers(functions, roots, options.opt_budget_ms, result));
+    }
+    std::set<std::string> multiversioned;
+    if (!options.multiversion.empty()) {
+        std::map<std::string, int> qualifiers;
+        for (const auto &[name, info] : functions) {
+            qualifiers[name] = info.def->data.function_def.qualifiers;
+        }
+        multiversioned = select_multiversioned_functions(qualifiers, result);
+    }
+    codegen.generate_program(ctx.root, globals);
+    global_vars_free(globals);
+
+    if (options.stats) {
+        record_phase(stats, "codegen", phase_start);
+        stats.ir_generated = count_ir(codegen.get_module());
+    }
+
+    optimize_and_emit(codegen, options, multiversioned, result, phase_start);
+    return result;
+}
+
+// C-style interface
+extern "C" {
+    int lib3cc_compile(const char *source, char **object, size_t *object_size,
+                       char **diagnostics) {
+        CompileResult result = compile(source, CompileOptions());
+
+        std::string messages;
+        for (const auto &message : result.diagnostics) {
+            messages += message;
+            messages += '\n';
+        }
+        *diagnostics = strdup(messages.c_str());
+
+        *object = nullptr;
+        *object_size = 0;
+        if (!result.success) {
+            return 1;
+        }
+
+        *object = static_cast<char *>(malloc(result.object.size()));
+        memcpy(*object, result.object.data(), result.object.size());
+        *object_size = result.object.size();
+        return 0;
+    }
+
+    void lib3cc_free(void *ptr) {
+        free(ptr);
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef LIB3CC_H
+#define LIB3CC_H
+
+#include "cost.h"
+#include "stats.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm::orc {
+class LLJIT;
+}
+
+// A program compiled into an in-process JIT. Symbols returned by lookup()
+// stay valid for the lifetime of the handle.
+class JITHandle {
+private:
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+
+public:
+    explicit JITHandle(std::unique_ptr<llvm::orc::LLJIT> jit);
+    ~JITHandle();
+
+    void *lookup(const std::string &name) const;
+    int run_main() const;
+};
+
+enum class CompileOutput {
+    OBJECT,
+    JIT,
+};
+
+struct CompileOptions {
+    CompileOutput output = CompileOutput::OBJECT;
+    int opt_level = 1;     // 0-3, as in -O0 .. -O3
+    // Optimize for size: 1 for -Os, 2 for -Oz, with opt_level 2 (see
+    // CodeGenerator::set_size_level)
+    int size_level = 0;
+    bool emit_ir = false;  // Also return the optimized module as textual IR
+    bool stats = false;    // Collect CompileResult::stats
+    bool freestanding = false;  // Use the built-in runtime instead of libc (runtime.h)
+    bool auto_memoize = false;  // Cache the results of pure recursive functions
+    // Call the profiling hooks of runtime/profile.c (lib3cc_rt) on entry
+    // to and exit from each function; not with freestanding
+    bool instrument_functions = false;
+    // Triples to build objects for; empty for the default target. Each must
+    // be one of THREECC_TARGETS. With several targets, the program is
+    // parsed and lowered once and the targets are built concurrently.
+    std::vector<std::string> target_triples;
+    // Functions to generate even when main cannot reach them, for callers
+    // outside the program. Other unreachable functions are only generated
+    // at -O0.
+    std::vector<std::string> exports;
+    bool callgraph = false;     // Set CompileResult::callgraph
+    // Estimate the cost of each function and loop in the optimized code
+    // on the target (cost.h); object files only
+    bool cost_report = false;
+    // x86-64 levels (x86-64-v2, x86-64-v3, x86-64-v4) to clone the
+    // functions declared hot for, behind an ifunc that picks the clone for
+    // the CPU when the program is loaded. Objects for x86-64 ELF targets
+    // only, and not with freestanding: libc resolves the ifuncs.
+    std::vector<std::string> multiversion;
+    // Generate each function as soon as it is parsed, and free its AST,
+    // instead of parsing the whole program first. Functions may then be
+    // called before their definition, but globals must be declared before
+    // the functions that use them, and initializers cannot call functions.
+    // Not with auto_memoize; unreachable functions are generated too.
+    bool streaming = false;
+    // Optimize each function as much as its loops, estimated calls and size
+    // say it is worth (OptTier): fully with the -O2 pipeline (or -O3's),
+    // only cleaned up, or not at all. At opt_level 1, the default, fully
+    // optimized functions also get the -O2 pipeline, which the functions
+    // optimized less pay for. Not with streaming; nothing at -O0.
+    bool adaptive_opt = false;
+    // With adaptive_opt, optimize fewer functions fully until the estimated
+    // time fits, and skip the optional passes left once optimization has
+    // taken this long. 0 for no budget.
+    double opt_budget_ms = 0;
+};
+
+// Output for one of several CompileOptions::target_triples
+struct TargetOutput {
+    std::string triple;
+    std::vector<char> object;
+    std::string ir;                    // Set when options.emit_ir
+    CostReport cost_report;            // Set when options.cost_report
+};
+
+struct CompileResult {
+    bool success = false;
+    std::vector<char> object;          // Set for CompileOutput::OBJECT with one target
+    std::vector<TargetOutput> targets; // Set instead with several targets
+    std::unique_ptr<JITHandle> jit;    // Set for CompileOutput::JIT
+    std::string ir;                    // Set when options.emit_ir, with one target
+    CompileStats stats;                // Set when options.stats
+    std::vector<std::string> remarks;  // What analyses decided, and why
+    std::string callgraph;             // Set when options.callgraph, one line per function
+    CostReport cost_report;            // Set when options.cost_report, with one target
+    std::vector<std::string> diagnostics;
+};
+
+// Compile a program entirely in memory. Each call owns its own parser,
+// LLVM context and module, so compile() may be called concurrently from
+// any number of threads. Compiles with options.stats run one at a time,
+// since the LLVM statistics they report are counted process-wide.
+CompileResult compile(const std::string &source, const CompileOptions &options);
+
+struct TieredOptions {
+    int opt_level = 2;            // For functions compiled by the JIT tier
+    long call_threshold = 1000;   // Calls that make a function hot
+    long loop_threshold = 10000;  // Loop iterations that make a function hot
+};
+
+struct RunResult {
+    bool success = false;
+    int exit_code = 0;            // What main() returned
+    std::vector<std::string> diagnostics;
+    std::vector<std::string> remarks;   // Tier-up events
+};
+
+// Run a program right away in the bytecode interpreter (bytecode.h),
+// while functions that become hot are compiled by the JIT on a background
+// thread. Once compiled, later calls of a function run native code; a
+// call already running in the interpreter finishes there.
+RunResult run_tiered(const std::string &source, const TieredOptions &options);
+
+// C-style interface for embedding from other languages. On success
+// returns 0 and stores a malloc'ed object file in *object. Diagnostics
+// (newline separated, possibly empty) are always stored in *diagnostics.
+// Release both with lib3cc_free().
+extern "C" {
+    int lib3cc_compile(const char *source, char **object, size_t *object_size,
+                       char **diagnostics);
+    void lib3cc_free(void *ptr);
+}
+
+#endif /* LIB3CC_H */
@@ -0,0 +1,64 @@
+#include "linker.h"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <mutex>
+
+#ifdef THREECC_HAVE_LLD
+#include <lld/Common/Driver.h>
+
+LLD_HAS_DRIVER(elf)
+#endif
+
+bool link_executable(const std::vector<char> &object, const std::string &output,
+                     bool minimize_size, std::vector<std::string> &diagnostics) {
+#ifndef THREECC_HAVE_LLD
+    diagnostics.push_back("3cc was built without lld; link the object file with clang instead");
+    return false;
+#else
+    // lld only reads its inputs from files
+    int fd;
+    llvm::SmallString<128> object_path;
+    if (auto ec = llvm::sys::fs::createTemporaryFile("3cc", "o", fd, object_path)) {
+        diagnostics.push_back("Could not create temporary file: " + ec.message());
+        return false;
+    }
+    {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out.write(object.data(), object.size());
+    }
+
+    // lld keeps global state, so links are serialized, and after a fatal
+    // error it cannot safely be run again in this process
+    static std::mutex lld_mutex;
+    static bool lld_usable = true;
+    std::lock_guard<std::mutex> lock(lld_mutex);
+
+    bool linked = false;
+    if (lld_usable) {
+        std::vector<const char*> args = {
+            "ld.lld", "-static", "--gc-sections", "-o", output.c_str(), object_path.c_str(),
+        };
+        if (minimize_size) {
+            args.push_back("--icf=all");
+            args.push_back("--strip-all");
+        }
+
+        std::string messages;
+        llvm::raw_string_ostream message_stream(messages);
+        lld::Result result = lld::lldMain(args, message_stream, message_stream,
+                                          {{lld::Gnu, &lld::elf::link}});
+        lld_usable = result.canRunAgain;
+        linked = result.retCode == 0;
+
+        if (!linked) {
+            diagnostics.push_back(messages.empty() ? "Linking failed" : messages);
+        }
+    } else {
+        diagnostics.push_back("The embedded linker is unavailable after an earlier fatal error");
+    }
+
+    llvm::sys::fs::remove(object_path);
+    return linked;
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <string>
+#include <vector>
+
+// Link an object compiled with CompileOptions::freestanding into a static
+// Linux executable using the embedded lld, without starting any external
+// process. Fails with a diagnostic when 3cc was built without lld.
+// minimize_size also folds identical functions and strips the symbol
+// table, for objects compiled with CompileOptions::size_level.
+bool link_executable(const std::vector<char> &object, const std::string &output,
+                     bool minimize_size, std::vector<std::string> &diagnostics);
+
+#endif /* LINKER_H */
@@ -1,96 +1,264 @@
-#include <iostream>
-#include <cstdio>
 #include <cstdlib>
-#include <cstring>
-#include "ast.h"
-#include "codegen.h"
-#include "symtab.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "lib3cc.h"
+#include "linker.h"
 
-extern void yy_scan_string(const char *str);
-extern int yyparse();
-extern ASTNode *root;
+static bool write_file(const std::string &filename, const char *data, size_t size) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cerr << "Could not open file: " << filename << std::endl;
+        return false;
+    }
+    out.write(data, size);
+    return static_cast<bool>(out);
+}
 
-static bool check_main_exists(ASTNode *node) {
-    if (!node) return false;
+static std::vector<std::string> split_list(const std::string &list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
 
-    if (node->type == ASTNodeType::AST_FUNCTION_DEF) {
-        if (strcmp(node->data.function_def.name, "main") == 0) {
-            return true;
-        }
-    } else if (node->type == ASTNodeType::AST_SEQUENCE) {
-        return check_main_exists(node->data.sequence.first) ||
-               check_main_exists(node->data.sequence.second);
+// Insert suffix before the extension: out.o -> out.<suffix>.o
+static std::string with_suffix(const std::string &filename, const std::string &suffix) {
+    size_t pos = filename.rfind('.');
+    if (pos == std::string::npos) {
+        return filename + "." + suffix;
     }
+    return filename.substr(0, pos) + "." + suffix + filename.substr(pos);
+}
 
-    return false;
+// The .ll file written next to an object file
+static std::string ir_filename(const std::string &output_file) {
+    std::string ir_file = output_file;
+    size_t pos = ir_file.rfind('.');
+    if (pos != std::string::npos) {
+        ir_file = ir_file.substr(0, pos) + ".ll";
+    } else {
+        ir_file += ".ll";
+    }
+    return ir_file;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2 || argc > 3) {
-        std::cerr << "Usage: " << argv[0] << " <source_code> [output_file]" << std::endl;
-        return 1;
+static bool write_output(const std::string &output_file, const std::string &ir,
+                         const std::vector<char> &object) {
+    // Output LLVM IR to .ll file for inspection
+    std::string ir_file = ir_filename(output_file);
+    if (!write_file(ir_file, ir.data(), ir.size())) {
+        return false;
     }
 
-    std::string output_file = "output.o";
-    if (argc == 3) {
-        output_file = argv[2];
+    // Output object file
+    if (!write_file(output_file, object.data(), object.size())) {
+        return false;
     }
 
-    global_symtab = symtab_create();
+    std::cout << "LLVM IR: " << ir_file << std::endl;
+    std::cout << "Object file: " << output_file << std::endl;
+    return true;
+}
+
+static void usage(const char *program) {
+    std::cerr << "Usage: " << program << " [-O0|-O1|-O2|-O3|-Os|-Oz] [--stats[=json]] [--cost-report[=json]] [--auto-memoize] [--instrument-functions] [--remarks] [--print-callgraph] [--export=<function>[,<function>...]] [--tiered] [--stream] [--adaptive-opt] [--opt-budget-ms=<ms>] [--target=<triple>[,<triple>...]] [--multiversion=<level>[,<level>...]] [-o executable] <source_code> [output_file]" << std::endl;
+}
 
-    yy_scan_string(argv[1]);
-    yyparse();
+int main(int argc, char **argv) {
+    CompileOptions options;
 
-    if (root) {
-        // Check if main function exists
-        if (root->type == ASTNodeType::AST_FUNCTION_DEF &&
-            strcmp(root->data.function_def.name, "main") == 0) {
-            // Single main function - OK
-        } else if (root->type == ASTNodeType::AST_SEQUENCE ||
-                   root->type == ASTNodeType::AST_FUNCTION_DEF) {
-            // Multiple functions or single non-main function - check if main exists
-            if (!check_main_exists(root)) {
-                std::cerr << "Error: main() function is required" << std::endl;
-                ast_free(root);
-                symtab_free(global_symtab);
+    bool stats_json = false;
+    bool cost_json = false;
+    bool remarks = false;
+    bool tiered = false;
+    bool opt_level_set = false;
+    std::string executable;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+            options.opt_level = arg[2] - '0';
+            options.size_level = 0;
+            opt_level_set = true;
+        } else if (arg == "-Os" || arg == "-Oz") {
+            // The -O2 pipeline, tuned for size
+            options.opt_level = 2;
+            options.size_level = arg == "-Os" ? 1 : 2;
+            opt_level_set = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            executable = argv[++i];
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--stats=json") {
+            options.stats = true;
+            stats_json = true;
+        } else if (arg == "--cost-report") {
+            options.cost_report = true;
+        } else if (arg == "--cost-report=json") {
+            options.cost_report = true;
+            cost_json = true;
+        } else if (arg == "--auto-memoize") {
+            options.auto_memoize = true;
+        } else if (arg == "--tiered") {
+            tiered = true;
+        } else if (arg == "--stream") {
+            options.streaming = true;
+        } else if (arg == "--adaptive-opt") {
+            options.adaptive_opt = true;
+        } else if (arg.rfind("--opt-budget-ms=", 0) == 0) {
+            // A budget only makes sense with tiers to demote
+            char *end;
+            options.opt_budget_ms = std::strtod(arg.c_str() + 16, &end);
+            if (*end || !(options.opt_budget_ms > 0)) {
+                std::cerr << "Invalid optimization budget: " << arg.substr(16) << std::endl;
                 return 1;
             }
+            options.adaptive_opt = true;
+        } else if (arg == "--remarks") {
+            remarks = true;
+        } else if (arg == "--instrument-functions") {
+            options.instrument_functions = true;
+        } else if (arg == "--print-callgraph") {
+            options.callgraph = true;
+        } else if (arg.rfind("--export=", 0) == 0) {
+            options.exports = split_list(arg.substr(9));
+        } else if (arg.rfind("--target=", 0) == 0) {
+            options.target_triples = split_list(arg.substr(9));
+        } else if (arg.rfind("--multiversion=", 0) == 0) {
+            options.multiversion = split_list(arg.substr(15));
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            usage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
         }
+    }
 
-        // Collect global variables
-        GlobalVar *globals = collect_global_vars(root);
+    if (positional.empty() || positional.size() > 2) {
+        usage(argv[0]);
+        return 1;
+    }
 
-        // Generate code using LLVM
-        CodeGenerator codegen;
-        codegen.generate_program(root, globals);
+    // Run the program instead of compiling it
+    if (tiered) {
+        if (positional.size() != 1 || !executable.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+        TieredOptions tiered_options;
+        if (opt_level_set) {
+            tiered_options.opt_level = options.opt_level;
+        }
+        RunResult run = run_tiered(positional[0], tiered_options);
+        for (const auto &message : run.diagnostics) {
+            std::cerr << message << std::endl;
+        }
+        if (remarks) {
+            for (const auto &remark : run.remarks) {
+                std::cerr << "remark: " << remark << std::endl;
+            }
+        }
+        return run.success ? run.exit_code : 1;
+    }
 
-        // Run LLVM optimization passes
-        codegen.optimize_module();
+    // With -o an object file is only written when explicitly requested
+    std::string output_file;
+    if (positional.size() == 2) {
+        output_file = positional[1];
+    } else if (executable.empty()) {
+        output_file = "output.o";
+    }
 
-        // Output LLVM IR to .ll file for inspection
-        std::string ir_file = output_file;
-        size_t pos = ir_file.rfind('.');
-        if (pos != std::string::npos) {
-            ir_file = ir_file.substr(0, pos) + ".ll";
-        } else {
-            ir_file += ".ll";
+    if (!executable.empty()) {
+        if (options.target_triples.size() > 1) {
+            std::cerr << "-o links a single target; drop it or pass one --target" << std::endl;
+            return 1;
+        }
+        if (options.instrument_functions) {
+            std::cerr << "--instrument-functions needs the profiling runtime: write an object file "
+                         "and link it with lib3cc_rt.a instead of using -o" << std::endl;
+            return 1;
         }
-        codegen.output_ir(ir_file);
+        if (!options.multiversion.empty()) {
+            std::cerr << "--multiversion needs libc to resolve its ifuncs: write an object file "
+                         "and link it with clang instead of using -o" << std::endl;
+            return 1;
+        }
+        options.freestanding = true;
+    }
+    options.emit_ir = !output_file.empty();
 
-        // Output object file
-        codegen.output_object_file(output_file);
+    CompileResult result = compile(positional[0], options);
+    for (const auto &message : result.diagnostics) {
+        std::cerr << message << std::endl;
+    }
+    if (!result.success) {
+        return 1;
+    }
 
-        std::cout << "Compilation successful!" << std::endl;
-        std::cout << "LLVM IR: " << ir_file << std::endl;
-        std::cout << "Object file: " << output_file << std::endl;
+    std::cout << "Compilation successful!" << std::endl;
+    std::cout << result.callgraph;
 
-        // Free globals
-        global_vars_free(globals);
+    if (!output_file.empty()) {
+        if (result.targets.empty()) {
+            if (!write_output(output_file, result.ir, result.object)) {
+                return 1;
+            }
+        }
+        for (const auto &target : result.targets) {
+            if (!write_output(with_suffix(output_file, target.triple), target.ir, target.object)) {
+                return 1;
+            }
+        }
+    }
+
+    if (!executable.empty()) {
+        std::vector<std::string> link_diagnostics;
+        bool linked = link_executable(result.object, executable, options.size_level > 0,
+                                      link_diagnostics);
+        for (const auto &message : link_diagnostics) {
+            std::cerr << message << std::endl;
+        }
+        if (!linked) {
+            return 1;
+        }
+        std::cout << "Executable: " << executable << std::endl;
+    }
+
+    if (remarks) {
+        for (const auto &remark : result.remarks) {
+            std::cerr << "remark: " << remark << std::endl;
+        }
+    }
 
-        ast_free(root);
+    if (options.stats) {
+        std::cerr << (stats_json ? format_stats_json(result.stats) : format_stats_table(result.stats));
     }
 
-    symtab_free(global_symtab);
+    if (options.cost_report) {
+        std::vector<const CostReport*> reports;
+        if (result.targets.empty()) {
+            reports.push_back(&result.cost_report);
+        }
+        for (const auto &target : result.targets) {
+            reports.push_back(&target.cost_report);
+        }
+        // Several targets: a JSON array with a report per target
+        if (cost_json && reports.size() > 1) std::cerr << "[\n";
+        for (size_t i = 0; i < reports.size(); i++) {
+            if (i > 0) std::cerr << (cost_json ? ",\n" : "\n");
+            std::cerr << (cost_json ? format_cost_json(*reports[i]) : format_cost_table(*reports[i]));
+        }
+        if (cost_json && reports.size() > 1) std::cerr << "]\n";
+    }
 
     return 0;
 }
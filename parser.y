@@ -2,33 +2,109 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <set>
+#include <string>
+%}
+
+%code requires {
 #include "ast.h"
-#include "symtab.h"
 
-void yyerror(const char *s);
-int yylex(void);
+struct CompileContext;
 
-ASTNode *root = nullptr;
-extern SymbolTable *global_symtab;
-%}
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
+
+%code {
+#include "context.h"
+
+int yylex(YYSTYPE *yylval_param, yyscan_t scanner);
+void yyerror(yyscan_t scanner, CompileContext *ctx, const char *s);
+
+// Report case values that more than one arm lists, and a second default
+static void check_switch_arms(CompileContext *ctx, SwitchArm *arms) {
+    std::set<int> seen;
+    bool has_default = false;
+    for (SwitchArm *arm = arms; arm; arm = arm->next) {
+        for (int value : arm->values) {
+            if (!seen.insert(value).second) {
+                ctx->diagnostics.push_back("Error: duplicate case " + std::to_string(value) +
+                                           " in switch");
+            }
+        }
+        if (arm->is_default && has_default) {
+            ctx->diagnostics.push_back("Error: a switch can only have one default");
+        }
+        has_default = has_default || arm->is_default;
+    }
+}
+
+// Qualifiers and branch hints are contextual keywords: plain identifiers,
+// so that programs can still use their names for variables and functions
+static bool span_is(Span span, const char *word) {
+    return span.length == static_cast<int>(strlen(word)) &&
+           memcmp(span.start, word, span.length) == 0;
+}
+
+static int qualifier_flag(CompileContext *ctx, Span word) {
+    if (span_is(word, "inline")) return QUALIFIER_INLINE;
+    if (span_is(word, "noinline")) return QUALIFIER_NOINLINE;
+    if (span_is(word, "hot")) return QUALIFIER_HOT;
+    if (span_is(word, "cold")) return QUALIFIER_COLD;
+    ctx->diagnostics.push_back("Error: unknown function qualifier " +
+                               std::string(word.start, word.length));
+    return 0;
+}
+
+static BranchHint branch_hint_of(CompileContext *ctx, Span word) {
+    if (span_is(word, "likely")) return BranchHint::LIKELY;
+    if (span_is(word, "unlikely")) return BranchHint::UNLIKELY;
+    ctx->diagnostics.push_back("Error: unknown branch hint " +
+                               std::string(word.start, word.length) +
+                               " (expected likely or unlikely)");
+    return BranchHint::NONE;
+}
+
+// Pass a completed top-level item on when streaming (CompileContext::on_item)
+static ASTNode *stream_item(CompileContext *ctx, ASTNode *item) {
+    if (!ctx->on_item) return item;
+    ctx->on_item(item);
+    return nullptr;
+}
+}
 
+%define api.pure full
+%lex-param { yyscan_t scanner }
+%parse-param { yyscan_t scanner } { CompileContext *ctx }
 
 %union {
     int number;
-    char *string;
+    Span span;
     ASTNode *node;
     ParamList *params;
     ArgList *args;
+    ReductionList *reductions;
+    SwitchArm *arms;
+    BinaryOp op;
+    BranchHint hint;
 }
 
 %token NUMBER
 %token IDENTIFIER
-%token ASSIGN SEMICOLON COMMA
+%token ASSIGN SEMICOLON COMMA COLON QUESTION
 %token RETURN WHILE FOR IF ELSE PRINT
+%token PARALLEL REDUCE
+%token SWITCH CASE DEFAULT
 %token ADD SUB MUL DIV
 %token LPAREN RPAREN LBRACE RBRACE
 %token LT GT LE GE EQ NE
+%token AND OR NOT
 
+%right QUESTION COLON
+%left OR
+%left AND
 %left EQ NE
 %left LT GT LE GE
 %left ADD SUB
@@ -38,26 +114,91 @@ extern SymbolTable *global_symtab;
 %type <node> program expr statement statements function_def global_decl toplevel_items toplevel_item
 %type <params> param_list param_list_opt
 %type <args> arg_list arg_list_opt
-%type <number> NUMBER
-%type <string> IDENTIFIER
+%type <number> NUMBER qualifiers qualifier case_value
+%type <arms> switch_arms switch_arm case_labels
+%type <reductions> reductions
+%type <op> reduction_op
+%type <hint> branch_hint
+%type <span> IDENTIFIER
 
 %%
 program:
-    toplevel_items { root = $1; $$ = $1; };
+    toplevel_items { ctx->root = $1; $$ = $1; };
 
 toplevel_items:
     toplevel_item { $$ = $1; }
-    | toplevel_items toplevel_item { $$ = ast_sequence($1, $2); };
+    | toplevel_items toplevel_item { $$ = ctx->on_item ? nullptr : ast_sequence($1, $2); };
 
 toplevel_item:
-    function_def { $$ = $1; }
-    | global_decl { $$ = $1; };
+    function_def { $$ = stream_item(ctx, $1); }
+    | global_decl { $$ = stream_item(ctx, $1); };
 
 function_def:
     IDENTIFIER LPAREN param_list_opt RPAREN LBRACE statements RBRACE {
-        $$ = ast_function_def($1, $3, $6);
+        $$ = ast_function_def($1, $3, $6, 0);
+    }
+    | qualifiers IDENTIFIER LPAREN param_list_opt RPAREN LBRACE statements RBRACE {
+        $$ = ast_function_def($2, $4, $7, $1);
+        if (($1 & QUALIFIER_INLINE) && ($1 & QUALIFIER_NOINLINE)) {
+            ctx->diagnostics.push_back("Error: a function cannot be both inline and noinline");
+        }
+        if (($1 & QUALIFIER_HOT) && ($1 & QUALIFIER_COLD)) {
+            ctx->diagnostics.push_back("Error: a function cannot be both hot and cold");
+        }
     };
 
+/* Not optional in function_def: an empty list would conflict with the
+   IDENTIFIER that starts a global declaration. A qualifier is an
+   IDENTIFIER followed by another, where a function name or a global is
+   followed by ( or = */
+qualifiers:
+    qualifier { $$ = $1; }
+    | qualifiers qualifier { $$ = $1 | $2; };
+
+qualifier:
+    IDENTIFIER { $$ = qualifier_flag(ctx, $1); };
+
+/* An IDENTIFIER between if or while and ( */
+branch_hint:
+    /* empty */ { $$ = BranchHint::NONE; }
+    | IDENTIFIER { $$ = branch_hint_of(ctx, $1); };
+
+/* reduce(+: sum) reduce(*: product) ... */
+reductions:
+    /* empty */ { $$ = nullptr; }
+    | REDUCE LPAREN reduction_op COLON IDENTIFIER RPAREN reductions {
+        $$ = reduction_list_create($3, $5, $7);
+    };
+
+reduction_op:
+    ADD { $$ = BinaryOp::OP_ADD; }
+    | MUL { $$ = BinaryOp::OP_MUL; };
+
+/* case 1: case 2: statements ... default: statements */
+switch_arms:
+    /* empty */ { $$ = nullptr; }
+    | switch_arm switch_arms { $1->next = $2; $$ = $1; };
+
+switch_arm:
+    case_labels statements { $1->body = $2; $$ = $1; };
+
+case_labels:
+    CASE case_value COLON { $$ = new SwitchArm(); $$->values.push_back($2); }
+    | DEFAULT COLON { $$ = new SwitchArm(); $$->is_default = true; }
+    | case_labels CASE case_value COLON { $1->values.push_back($3); $$ = $1; }
+    | case_labels DEFAULT COLON {
+        if ($1->is_default) {
+            ctx->diagnostics.push_back("Error: a switch can only have one default");
+        }
+        $1->is_default = true;
+        $$ = $1;
+    };
+
+/* Negated as the generated arithmetic would, wrapping */
+case_value:
+    NUMBER { $$ = $1; }
+    | SUB NUMBER { $$ = static_cast<int>(0u - static_cast<unsigned>($2)); };
+
 global_decl:
     IDENTIFIER ASSIGN expr SEMICOLON {
         $$ = ast_global_var($1, $3);
@@ -98,17 +239,25 @@ statement:
     | RETURN expr SEMICOLON { $$ = ast_return($2); }
     | PRINT LPAREN expr RPAREN SEMICOLON { $$ = ast_print($3); }
     | expr SEMICOLON { $$ = $1; }
-    | WHILE LPAREN expr RPAREN LBRACE statements RBRACE {
-        $$ = ast_while($3, $6);
+    | WHILE branch_hint LPAREN expr RPAREN LBRACE statements RBRACE {
+        $$ = ast_while($4, $7, $2);
     }
     | FOR LPAREN statement expr SEMICOLON IDENTIFIER ASSIGN expr RPAREN LBRACE statements RBRACE {
         $$ = ast_for($3, $4, ast_assignment($6, $8), $11);
     }
-    | IF LPAREN expr RPAREN LBRACE statements RBRACE {
-        $$ = ast_if($3, $6, nullptr);
+    | PARALLEL FOR LPAREN IDENTIFIER ASSIGN expr SEMICOLON expr SEMICOLON IDENTIFIER ASSIGN expr RPAREN
+      reductions LBRACE statements RBRACE {
+        $$ = ast_parallel_for(ast_assignment($4, $6), $8, ast_assignment($10, $12), $14, $16);
+    }
+    | IF branch_hint LPAREN expr RPAREN LBRACE statements RBRACE {
+        $$ = ast_if($4, $7, nullptr, $2);
+    }
+    | IF branch_hint LPAREN expr RPAREN LBRACE statements RBRACE ELSE LBRACE statements RBRACE {
+        $$ = ast_if($4, $7, $11, $2);
     }
-    | IF LPAREN expr RPAREN LBRACE statements RBRACE ELSE LBRACE statements RBRACE {
-        $$ = ast_if($3, $6, $10);
+    | SWITCH LPAREN expr RPAREN LBRACE switch_arms RBRACE {
+        check_switch_arms(ctx, $6);
+        $$ = ast_switch($3, $6);
     };
 
 expr:
@@ -129,9 +278,13 @@ expr:
     | expr GE expr { $$ = ast_binary(BinaryOp::OP_GE, $1, $3); }
     | expr EQ expr { $$ = ast_binary(BinaryOp::OP_EQ, $1, $3); }
     | expr NE expr { $$ = ast_binary(BinaryOp::OP_NE, $1, $3); }
+    | expr AND expr { $$ = ast_binary(BinaryOp::OP_AND, $1, $3); }
+    | expr OR expr { $$ = ast_binary(BinaryOp::OP_OR, $1, $3); }
+    | NOT expr %prec UNARY { $$ = ast_binary(BinaryOp::OP_EQ, $2, ast_number(0)); }
+    | expr QUESTION expr COLON expr { $$ = ast_conditional($1, $3, $5); }
     | LPAREN expr RPAREN { $$ = $2; };
 %%
 
-void yyerror(const char *s) {
-    fprintf(stderr, "%s\n", s);
+void yyerror(yyscan_t scanner, CompileContext *ctx, const char *s) {
+    ctx->diagnostics.push_back(s);
 }
@@ -0,0 +1,263 @@
+#include "runtime.h"
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Triple.h>
+
+// Per-architecture entry point and syscall wrappers. _start is written in
+// assembly because the stack is not call-aligned at process entry.
+static const char *x86_64_runtime = R"IR(
+module asm ".globl _start"
+module asm "_start:"
+module asm "  xorl %ebp, %ebp"
+module asm "  andq $-16, %rsp"
+module asm "  callq __3cc_start"
+module asm "  hlt"
+
+define internal i64 @__3cc_write(i64 %fd, i64 %buf, i64 %len) #0 {
+entry:
+  %result = call i64 asm sideeffect "syscall", "={rax},{rax},{rdi},{rsi},{rdx},~{rcx},~{r11},~{memory}"(i64 1, i64 %fd, i64 %buf, i64 %len)
+  ret i64 %result
+}
+
+define internal void @__3cc_exit(i64 %status) #0 {
+entry:
+  %result = call i64 asm sideeffect "syscall", "={rax},{rax},{rdi},~{rcx},~{r11},~{memory}"(i64 231, i64 %status)
+  unreachable
+}
+)IR";
+
+static const char *aarch64_runtime = R"IR(
+module asm ".globl _start"
+module asm "_start:"
+module asm "  mov x29, #0"
+module asm "  mov x30, #0"
+module asm "  bl __3cc_start"
+module asm "  brk #0"
+
+define internal i64 @__3cc_write(i64 %fd, i64 %buf, i64 %len) #0 {
+entry:
+  %result = call i64 asm sideeffect "svc #0", "={x0},{x8},{x0},{x1},{x2},~{memory}"(i64 64, i64 %fd, i64 %buf, i64 %len)
+  ret i64 %result
+}
+
+define internal void @__3cc_exit(i64 %status) #0 {
+entry:
+  %result = call i64 asm sideeffect "svc #0", "={x0},{x8},{x0},~{memory}"(i64 94, i64 %status)
+  unreachable
+}
+)IR";
+
+// Architecture-independent part: stdout buffering, print and startup.
+// "no-builtins" keeps the backend from turning the copy loops back into
+// memcpy calls, which would need libc.
+static const char *common_runtime = R"IR(
+@__3cc_out_buf = internal global [4096 x i8] zeroinitializer
+@__3cc_out_len = internal global i64 0
+
+declare i32 @main()
+
+define internal void @__3cc_flush() #0 {
+entry:
+  %len = load i64, ptr @__3cc_out_len
+  %buf = ptrtoint ptr @__3cc_out_buf to i64
+  %empty = icmp eq i64 %len, 0
+  br i1 %empty, label %done, label %write
+
+write:
+  %offset = phi i64 [ 0, %entry ], [ %offset.next, %more ]
+  %rest = sub i64 %len, %offset
+  %ptr = add i64 %buf, %offset
+  %written = call i64 @__3cc_write(i64 1, i64 %ptr, i64 %rest)
+  %failed = icmp slt i64 %written, 1
+  br i1 %failed, label %done, label %more
+
+more:
+  %offset.next = add i64 %offset, %written
+  %again = icmp ult i64 %offset.next, %len
+  br i1 %again, label %write, label %done
+
+done:
+  store i64 0, ptr @__3cc_out_len
+  ret void
+}
+
+define void @__3cc_print(i32 %value) #0 {
+entry:
+  %digits = alloca [12 x i8]
+  %neg = icmp slt i32 %value, 0
+  %wide = sext i32 %value to i64
+  %negated = sub i64 0, %wide
+  %magnitude = select i1 %neg, i64 %negated, i64 %wide
+  br label %convert
+
+convert:
+  %count = phi i64 [ 0, %entry ], [ %count.next, %convert ]
+  %n = phi i64 [ %magnitude, %entry ], [ %quot, %convert ]
+  %quot = udiv i64 %n, 10
+  %rem = urem i64 %n, 10
+  %digit = trunc i64 %rem to i8
+  %char = add i8 %digit, 48
+  %slot = getelementptr inbounds [12 x i8], ptr %digits, i64 0, i64 %count
+  store i8 %char, ptr %slot
+  %count.next = add i64 %count, 1
+  %more = icmp ne i64 %quot, 0
+  br i1 %more, label %convert, label %reserve
+
+reserve:
+  %len = load i64, ptr @__3cc_out_len
+  %full = icmp ugt i64 %len, 4084
+  br i1 %full, label %flush, label %sign
+
+flush:
+  call void @__3cc_flush()
+  br label %sign
+
+sign:
+  %start = phi i64 [ %len, %reserve ], [ 0, %flush ]
+  br i1 %neg, label %minus, label %copy.entry
+
+minus:
+  %minus.slot = getelementptr inbounds [4096 x i8], ptr @__3cc_out_buf, i64 0, i64 %start
+  store i8 45, ptr %minus.slot
+  %after.minus = add i64 %start, 1
+  br label %copy.entry
+
+copy.entry:
+  %first = phi i64 [ %start, %sign ], [ %after.minus, %minus ]
+  br label %copy
+
+copy:
+  %i = phi i64 [ %count.next, %copy.entry ], [ %i.next, %copy ]
+  %pos = phi i64 [ %first, %copy.entry ], [ %pos.next, %copy ]
+  %i.next = sub i64 %i, 1
+  %src = getelementptr inbounds [12 x i8], ptr %digits, i64 0, i64 %i.next
+  %c = load i8, ptr %src
+  %dst = getelementptr inbounds [4096 x i8], ptr @__3cc_out_buf, i64 0, i64 %pos
+  store i8 %c, ptr %dst
+  %pos.next = add i64 %pos, 1
+  %copied = icmp eq i64 %i.next, 0
+  br i1 %copied, label %newline, label %copy
+
+newline:
+  %nl = getelementptr inbounds [4096 x i8], ptr @__3cc_out_buf, i64 0, i64 %pos.next
+  store i8 10, ptr %nl
+  %end = add i64 %pos.next, 1
+  store i64 %end, ptr @__3cc_out_len
+  ret void
+}
+
+define void @__3cc_start() #1 {
+entry:
+  %status = call i32 @main()
+  call void @__3cc_flush()
+  %code = sext i32 %status to i64
+  call void @__3cc_exit(i64 %code)
+  unreachable
+}
+
+attributes #0 = { nounwind "no-builtins" }
+attributes #1 = { noreturn nounwind "no-builtins" }
+)IR";
+
+// Startup and print for -Oz: each line is formatted back to front on the
+// stack, sign and newline included, and written with a single syscall
+static const char *unbuffered_runtime = R"IR(
+declare i32 @main()
+
+define void @__3cc_print(i32 %value) #0 {
+entry:
+  %line = alloca [12 x i8]
+  %newline = getelementptr inbounds [12 x i8], ptr %line, i64 0, i64 11
+  store i8 10, ptr %newline
+  %neg = icmp slt i32 %value, 0
+  %wide = sext i32 %value to i64
+  %negated = sub i64 0, %wide
+  %magnitude = select i1 %neg, i64 %negated, i64 %wide
+  br label %convert
+
+convert:
+  %pos = phi i64 [ 11, %entry ], [ %pos.next, %convert ]
+  %n = phi i64 [ %magnitude, %entry ], [ %quot, %convert ]
+  %quot = udiv i64 %n, 10
+  %rem = urem i64 %n, 10
+  %digit = trunc i64 %rem to i8
+  %char = add i8 %digit, 48
+  %pos.next = sub i64 %pos, 1
+  %slot = getelementptr inbounds [12 x i8], ptr %line, i64 0, i64 %pos.next
+  store i8 %char, ptr %slot
+  %more = icmp ne i64 %quot, 0
+  br i1 %more, label %convert, label %sign
+
+sign:
+  br i1 %neg, label %minus, label %write
+
+minus:
+  %minus.pos = sub i64 %pos.next, 1
+  %minus.slot = getelementptr inbounds [12 x i8], ptr %line, i64 0, i64 %minus.pos
+  store i8 45, ptr %minus.slot
+  br label %write
+
+write:
+  %first = phi i64 [ %pos.next, %sign ], [ %minus.pos, %minus ]
+  %start = getelementptr inbounds [12 x i8], ptr %line, i64 0, i64 %first
+  %buf = ptrtoint ptr %start to i64
+  %len = sub i64 12, %first
+  %written = call i64 @__3cc_write(i64 1, i64 %buf, i64 %len)
+  ret void
+}
+
+define void @__3cc_start() #1 {
+entry:
+  %status = call i32 @main()
+  %code = sext i32 %status to i64
+  call void @__3cc_exit(i64 %code)
+  unreachable
+}
+
+attributes #0 = { nounwind "no-builtins" }
+attributes #1 = { noreturn nounwind "no-builtins" }
+)IR";
+
+bool link_runtime(llvm::Module &module, const llvm::Triple &triple, bool unbuffered,
+                  std::string &error) {
+    if (!triple.isOSLinux()) {
+        error = "The built-in runtime only supports Linux targets, not " + triple.str();
+        return false;
+    }
+
+    std::string source;
+    switch (triple.getArch()) {
+        case llvm::Triple::x86_64:
+            source = x86_64_runtime;
+            break;
+        case llvm::Triple::aarch64:
+            source = aarch64_runtime;
+            break;
+        default:
+            error = "The built-in runtime does not support " + triple.getArchName().str();
+            return false;
+    }
+    source += unbuffered ? unbuffered_runtime : common_runtime;
+
+    llvm::SMDiagnostic diagnostic;
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(source, "3cc-runtime");
+    std::unique_ptr<llvm::Module> runtime = llvm::parseIR(*buffer, diagnostic, module.getContext());
+    if (!runtime) {
+        llvm::raw_string_ostream stream(error);
+        diagnostic.print("3cc-runtime", stream);
+        return false;
+    }
+
+    runtime->setTargetTriple(module.getTargetTriple());
+    runtime->setDataLayout(module.getDataLayout());
+
+    if (llvm::Linker::linkModules(module, std::move(runtime))) {
+        error = "Failed to link the built-in runtime";
+        return false;
+    }
+    return true;
+}
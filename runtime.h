@@ -0,0 +1,19 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <string>
+
+namespace llvm {
+class Module;
+class Triple;
+}
+
+// Minimal freestanding runtime for executables that 3cc links itself:
+// _start, a buffered print(), and exit, implemented with raw Linux
+// syscalls so no libc or crt objects are needed. Supports x86-64 and
+// AArch64 Linux. The unbuffered variant, for -Oz, writes each line as it
+// is printed: less code and no output buffer, at a syscall per print.
+bool link_runtime(llvm::Module &module, const llvm::Triple &triple, bool unbuffered,
+                  std::string &error);
+
+#endif /* RUNTIME_H */
@@ -0,0 +1,256 @@
+/*
+ * Work-stealing thread pool for parallel for loops.
+ *
+ * The compiler outlines the body of a parallel loop into a function that
+ * runs a range of iterations, and calls __3cc_parallel_for with the number
+ * of iterations. The calling thread and the pool threads each start with
+ * an equal share of the range. A thread takes small chunks from the front
+ * of its own share; one that runs out steals the back half of what is
+ * left of another's. Uneven iterations thus even out without a shared
+ * queue that every chunk would have to go through.
+ *
+ * Reductions are accumulated per thread and combined at the end. + and *
+ * on 32-bit integers wrap, so the result does not depend on how the
+ * iterations were split.
+ *
+ * THREECC_NUM_THREADS sets the number of threads, the calling thread
+ * included (default: one per online CPU). One loop runs on the pool at a
+ * time; loops nested in a parallel loop, or started while the pool is
+ * busy, run on their own thread.
+ */
+
+#define _GNU_SOURCE
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+
+/* Chunks per thread that a share is split into, at least */
+#define CHUNKS_PER_THREAD 32
+
+/* Accumulator rows are a cache line apart, so threads do not share lines */
+#define ROW_ALIGNMENT 16
+
+/* What is left of one thread's share of the iterations */
+typedef struct {
+    pthread_mutex_t lock;
+    int64_t next;
+    int64_t end;
+} __attribute__((aligned(64))) Share;
+
+typedef struct {
+    ParallelLoopBody body;
+    void *env;
+    int64_t grain;              /* Iterations per chunk */
+    int32_t *accumulators;      /* One row per thread */
+    size_t row_length;
+} Job;
+
+static struct {
+    int threads;                /* Including the thread that starts a loop */
+    Share *shares;
+
+    pthread_mutex_t lock;       /* Protects the fields below */
+    pthread_cond_t job_posted;
+    pthread_cond_t job_done;
+    unsigned long generation;   /* Incremented for every job */
+    const Job *job;
+    int helpers_running;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .job_posted = PTHREAD_COND_INITIALIZER,
+    .job_done = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_busy = PTHREAD_MUTEX_INITIALIZER;
+static __thread int in_loop;
+
+static int take_chunk(Share *share, int64_t grain, int64_t *begin, int64_t *end) {
+    pthread_mutex_lock(&share->lock);
+    int found = share->next < share->end;
+    if (found) {
+        *begin = share->next;
+        *end = share->end - share->next > grain ? share->next + grain : share->end;
+        share->next = *end;
+    }
+    pthread_mutex_unlock(&share->lock);
+    return found;
+}
+
+/* Move the back half of another thread's share (all of it, if that is
+   only one chunk) into the thread's own, empty share */
+static int steal(int self, int64_t grain) {
+    for (int i = 1; i < pool.threads; i++) {
+        Share *victim = &pool.shares[(self + i) % pool.threads];
+        int64_t begin = 0, end = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        int64_t left = victim->end - victim->next;
+        if (left > 0) {
+            end = victim->end;
+            begin = left > grain ? victim->end - left / 2 : victim->next;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (begin < end) {
+            Share *own = &pool.shares[self];
+            pthread_mutex_lock(&own->lock);
+            own->next = begin;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Run chunks until no share has any iterations left. Iterations that
+   another thread has taken are that thread's to finish. */
+static void run_job(const Job *job, int self) {
+    int32_t *accumulators = job->accumulators + (size_t)self * job->row_length;
+    Share *own = &pool.shares[self];
+    for (;;) {
+        int64_t begin, end;
+        if (take_chunk(own, job->grain, &begin, &end)) {
+            job->body(job->env, begin, end, accumulators);
+        } else if (!steal(self, job->grain)) {
+            return;
+        }
+    }
+}
+
+static void *helper_main(void *arg) {
+    int self = (int)(intptr_t)arg;
+    unsigned long seen = 0;
+    in_loop = 1;
+
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.job_posted, &pool.lock);
+        }
+        seen = pool.generation;
+        const Job *job = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_job(job, self);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.helpers_running == 0) {
+            pthread_cond_signal(&pool.job_done);
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static void start_pool(void) {
+    long threads = 0;
+    const char *setting = getenv("THREECC_NUM_THREADS");
+    if (setting && *setting) {
+        threads = strtol(setting, NULL, 10);
+    }
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    pool.shares = aligned_alloc(64, sizeof(Share) * (size_t)threads);
+    if (!pool.shares) {
+        pool.threads = 1;
+        return;
+    }
+    for (long i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool.shares[i].lock, NULL);
+    }
+
+    /* Thread 0 is whichever thread starts a loop */
+    pool.threads = 1;
+    for (long i = 1; i < threads; i++) {
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        int failed = pthread_create(&thread, &attributes, helper_main, (void *)(intptr_t)i);
+        pthread_attr_destroy(&attributes);
+        if (failed) break;
+        pool.threads++;
+    }
+}
+
+static int32_t combine(char op, int32_t a, int32_t b) {
+    return op == '*' ? (int32_t)((uint32_t)a * (uint32_t)b)
+                     : (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+void __3cc_parallel_for(ParallelLoopBody body, void *env, int64_t count, const char *ops,
+                        int32_t *results) {
+    if (count <= 0) return;
+
+    pthread_once(&pool_once, start_pool);
+    if (in_loop || pool.threads == 1 || count == 1 || pthread_mutex_trylock(&pool_busy) != 0) {
+        body(env, 0, count, results);
+        return;
+    }
+    in_loop = 1;
+
+    int threads = pool.threads;
+    size_t reductions = strlen(ops);
+    size_t row_length = (reductions + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+    int32_t *accumulators = NULL;
+    if (row_length > 0) {
+        accumulators = aligned_alloc(64, sizeof(int32_t) * row_length * (size_t)threads);
+        if (!accumulators) {
+            in_loop = 0;
+            pthread_mutex_unlock(&pool_busy);
+            body(env, 0, count, results);
+            return;
+        }
+        for (int t = 0; t < threads; t++) {
+            for (size_t k = 0; k < reductions; k++) {
+                accumulators[(size_t)t * row_length + k] = ops[k] == '*' ? 1 : 0;
+            }
+        }
+    }
+
+    int64_t grain = count / ((int64_t)threads * CHUNKS_PER_THREAD);
+    Job job = {body, env, grain > 0 ? grain : 1, accumulators, row_length};
+
+    /* No helper touches the shares until the job is posted */
+    for (int t = 0; t < threads; t++) {
+        pool.shares[t].next = count / threads * t + (t < count % threads ? t : count % threads);
+        pool.shares[t].end = pool.shares[t].next + count / threads + (t < count % threads);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.helpers_running = threads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.job_posted);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_job(&job, 0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.helpers_running > 0) {
+        pthread_cond_wait(&pool.job_done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int t = 0; t < threads; t++) {
+        for (size_t k = 0; k < reductions; k++) {
+            results[k] = combine(ops[k], results[k], accumulators[(size_t)t * row_length + k]);
+        }
+    }
+    free(accumulators);
+
+    in_loop = 0;
+    pthread_mutex_unlock(&pool_busy);
+}
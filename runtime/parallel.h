@@ -0,0 +1,29 @@
+/*
+ * Entry point of the parallel for runtime (parallel.c), which the code
+ * generated for parallel loops calls.
+ */
+
+#ifndef THREECC_PARALLEL_H
+#define THREECC_PARALLEL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An outlined loop body: runs iterations [begin, end) and combines its
+   reduction variables into accumulators[0..] */
+typedef void (*ParallelLoopBody)(void *env, int64_t begin, int64_t end, int32_t *accumulators);
+
+/* Run iterations [0, count) of body on the thread pool. ops has one
+   character, '+' or '*', per reduction variable; results holds their
+   values before the loop, and their values after it on return. */
+void __3cc_parallel_for(ParallelLoopBody body, void *env, int64_t count, const char *ops,
+                        int32_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THREECC_PARALLEL_H */
@@ -0,0 +1,329 @@
+/*
+ * Profiling runtime for programs compiled with --instrument-functions.
+ *
+ * The compiler calls __cyg_profile_func_enter/exit around every function
+ * that survives inlining. Each thread records a calling-context tree: one
+ * node per distinct call path, holding its call count and the timestamp
+ * counter cycles spent in the function itself. Nothing is shared between
+ * threads while the program runs, so the hooks take no locks.
+ *
+ * At exit the trees of all threads are merged into a report on stderr, or
+ * written to a file. Other threads may still be running then (the pool
+ * threads of parallel for never exit), so the report first stops all
+ * recording: each hook marks its thread as inside a hook while it touches
+ * the tree, and gives up if recording has stopped; the report sets stopped
+ * and waits until no thread is inside a hook. Environment variables:
+ *
+ *   THREECC_PROFILE_FORMAT  report (default): per-function calls and
+ *                           inclusive/exclusive cycles, hottest first
+ *                           collapsed: one "main;f;g <cycles>" line per
+ *                           call path, for flame graph tools
+ *   THREECC_PROFILE_FILE    write there instead of stderr
+ *
+ * Function names come from dladdr, so link with -rdynamic to see them.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+typedef struct Node {
+    void *function;
+    struct Node *parent;
+    struct Node *children;      /* Most recently entered first */
+    struct Node *next_sibling;
+    uint64_t calls;
+    uint64_t exclusive;
+} Node;
+
+typedef struct {
+    Node *node;
+    uint64_t start;
+    uint64_t children;          /* Cycles spent in callees */
+} Frame;
+
+typedef struct ThreadProfile {
+    Node root;
+    Node *current;
+    Frame *frames;
+    size_t depth;
+    size_t capacity;
+    atomic_int in_hook;         /* Set while a hook changes the tree */
+    struct ThreadProfile *next;
+} ThreadProfile;
+
+static pthread_mutex_t profiles_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadProfile *profiles;
+static __thread ThreadProfile *thread_profile;
+static atomic_int stopped;      /* Set once the report is being written */
+
+NO_INSTRUMENT static inline uint64_t read_counter(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static void write_profile(void);
+
+NO_INSTRUMENT static ThreadProfile *start_thread(void) {
+    ThreadProfile *profile = calloc(1, sizeof(ThreadProfile));
+    if (!profile) abort();
+    profile->current = &profile->root;
+
+    pthread_mutex_lock(&profiles_lock);
+    if (!profiles) {
+        atexit(write_profile);
+    }
+    profile->next = profiles;
+    profiles = profile;
+    pthread_mutex_unlock(&profiles_lock);
+
+    thread_profile = profile;
+    return profile;
+}
+
+/* Both sequentially consistent, so that either the hook sees stopped or
+   write_profile sees in_hook, as in Dekker's algorithm */
+NO_INSTRUMENT static int begin_hook(ThreadProfile *profile) {
+    atomic_store(&profile->in_hook, 1);
+    if (atomic_load(&stopped)) {
+        atomic_store_explicit(&profile->in_hook, 0, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
+
+NO_INSTRUMENT static void end_hook(ThreadProfile *profile) {
+    atomic_store_explicit(&profile->in_hook, 0, memory_order_release);
+}
+
+NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *call_site) {
+    (void)call_site;
+    ThreadProfile *profile = thread_profile ? thread_profile : start_thread();
+    if (!begin_hook(profile)) return;
+
+    /* Find the call path node, moving it to the front: a loop calling the
+       same functions finds them at once */
+    Node *parent = profile->current;
+    Node **link = &parent->children;
+    Node *node = *link;
+    while (node && node->function != function) {
+        link = &node->next_sibling;
+        node = *link;
+    }
+    if (node) {
+        *link = node->next_sibling;
+    } else {
+        node = calloc(1, sizeof(Node));
+        if (!node) abort();
+        node->function = function;
+        node->parent = parent;
+    }
+    node->next_sibling = parent->children;
+    parent->children = node;
+
+    if (profile->depth == profile->capacity) {
+        profile->capacity = profile->capacity ? profile->capacity * 2 : 256;
+        profile->frames = realloc(profile->frames, profile->capacity * sizeof(Frame));
+        if (!profile->frames) abort();
+    }
+    Frame *frame = &profile->frames[profile->depth++];
+    frame->node = node;
+    frame->children = 0;
+    node->calls++;
+    profile->current = node;
+    frame->start = read_counter();
+    end_hook(profile);
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *call_site) {
+    uint64_t end = read_counter();
+    (void)function;
+    (void)call_site;
+
+    ThreadProfile *profile = thread_profile;
+    if (!profile || !begin_hook(profile)) return;
+    if (profile->depth == 0) {
+        end_hook(profile);
+        return;
+    }
+
+    Frame *frame = &profile->frames[--profile->depth];
+    uint64_t elapsed = end - frame->start;
+    frame->node->exclusive += elapsed - frame->children;
+    if (profile->depth > 0) {
+        profile->frames[profile->depth - 1].children += elapsed;
+    }
+    profile->current = frame->node->parent;
+    end_hook(profile);
+}
+
+/* Per-function totals, merged over all threads and call paths */
+typedef struct {
+    void *function;
+    const char *name;
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+} FunctionTotal;
+
+typedef struct {
+    FunctionTotal *items;
+    size_t count;
+    size_t capacity;
+} Totals;
+
+NO_INSTRUMENT static FunctionTotal *find_total(Totals *totals, void *function) {
+    for (size_t i = 0; i < totals->count; i++) {
+        if (totals->items[i].function == function) return &totals->items[i];
+    }
+    if (totals->count == totals->capacity) {
+        totals->capacity = totals->capacity ? totals->capacity * 2 : 64;
+        totals->items = realloc(totals->items, totals->capacity * sizeof(FunctionTotal));
+        if (!totals->items) abort();
+    }
+    FunctionTotal *total = &totals->items[totals->count++];
+    memset(total, 0, sizeof(*total));
+    total->function = function;
+    return total;
+}
+
+NO_INSTRUMENT static const char *function_name(void *function) {
+    Dl_info info;
+    if (dladdr(function, &info) && info.dli_sname) {
+        return info.dli_sname;
+    }
+    static __thread char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%p", function);
+    return buffer;
+}
+
+NO_INSTRUMENT static int on_path(const Node *node, void *function) {
+    for (; node; node = node->parent) {
+        if (node->function == function) return 1;
+    }
+    return 0;
+}
+
+/* Returns the node's inclusive cycles. Time in a recursive function only
+   counts once towards its inclusive total, at the outermost call. */
+NO_INSTRUMENT static uint64_t add_totals(const Node *node, Totals *totals) {
+    uint64_t inclusive = node->exclusive;
+    for (const Node *child = node->children; child; child = child->next_sibling) {
+        inclusive += add_totals(child, totals);
+    }
+    if (node->function) {
+        FunctionTotal *total = find_total(totals, node->function);
+        total->calls += node->calls;
+        total->exclusive += node->exclusive;
+        if (!on_path(node->parent, node->function)) {
+            total->inclusive += inclusive;
+        }
+    }
+    return inclusive;
+}
+
+NO_INSTRUMENT static int by_exclusive(const void *a, const void *b) {
+    const FunctionTotal *x = a, *y = b;
+    if (x->exclusive != y->exclusive) return x->exclusive < y->exclusive ? 1 : -1;
+    return 0;
+}
+
+NO_INSTRUMENT static void write_report(FILE *out) {
+    Totals totals = {0};
+    uint64_t all = 0;
+    for (ThreadProfile *profile = profiles; profile; profile = profile->next) {
+        all += add_totals(&profile->root, &totals);
+    }
+    qsort(totals.items, totals.count, sizeof(FunctionTotal), by_exclusive);
+
+    fprintf(out, "%-24s %12s %16s %16s %7s\n",
+            "function", "calls", "inclusive", "exclusive", "excl %");
+    for (size_t i = 0; i < totals.count; i++) {
+        FunctionTotal *total = &totals.items[i];
+        fprintf(out, "%-24s %12llu %16llu %16llu %6.1f%%\n", function_name(total->function),
+                (unsigned long long)total->calls, (unsigned long long)total->inclusive,
+                (unsigned long long)total->exclusive,
+                all ? 100.0 * (double)total->exclusive / (double)all : 0.0);
+    }
+    free(totals.items);
+}
+
+NO_INSTRUMENT static void write_collapsed_node(FILE *out, const Node *node, char *path,
+                                               size_t length, size_t size) {
+    size_t next = length;
+    if (node->function) {
+        const char *name = function_name(node->function);
+        int written = snprintf(path + length, size - length, "%s%s", length ? ";" : "", name);
+        next = written < 0 ? length : length + (size_t)written;
+        if (next >= size) next = size - 1;
+        if (node->exclusive > 0) {
+            fprintf(out, "%s %llu\n", path, (unsigned long long)node->exclusive);
+        }
+    }
+    for (const Node *child = node->children; child; child = child->next_sibling) {
+        write_collapsed_node(out, child, path, next, size);
+    }
+    path[length] = '\0';
+}
+
+NO_INSTRUMENT static void write_collapsed(FILE *out) {
+    char path[8192] = "";
+    for (ThreadProfile *profile = profiles; profile; profile = profile->next) {
+        write_collapsed_node(out, &profile->root, path, 0, sizeof(path));
+    }
+}
+
+NO_INSTRUMENT static void write_profile(void) {
+    const char *format = getenv("THREECC_PROFILE_FORMAT");
+    const char *filename = getenv("THREECC_PROFILE_FILE");
+
+    FILE *out = stderr;
+    if (filename && *filename) {
+        out = fopen(filename, "w");
+        if (!out) {
+            fprintf(stderr, "3cc profile: cannot write %s\n", filename);
+            return;
+        }
+    }
+
+    /* Calls still running in other threads are left out */
+    atomic_store(&stopped, 1);
+    pthread_mutex_lock(&profiles_lock);
+    for (ThreadProfile *profile = profiles; profile; profile = profile->next) {
+        while (atomic_load_explicit(&profile->in_hook, memory_order_acquire)) {
+            sched_yield();
+        }
+    }
+    if (format && strcmp(format, "collapsed") == 0) {
+        write_collapsed(out);
+    } else {
+        write_report(out);
+    }
+    pthread_mutex_unlock(&profiles_lock);
+
+    if (out != stderr) {
+        fclose(out);
+    }
+}
@@ -0,0 +1,332 @@
+#include "stats.h"
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <sys/resource.h>
+
+void count_ast_nodes(ASTNode *node, CompileStats &stats) {
+    if (!node) return;
+
+    stats.ast_nodes[ast_node_type_name(node->type)]++;
+
+    switch (node->type) {
+        case ASTNodeType::AST_BINARY_OP:
+            count_ast_nodes(node->data.binary.left, stats);
+            count_ast_nodes(node->data.binary.right, stats);
+            break;
+        case ASTNodeType::AST_CONDITIONAL:
+            count_ast_nodes(node->data.conditional.condition, stats);
+            count_ast_nodes(node->data.conditional.then_value, stats);
+            count_ast_nodes(node->data.conditional.else_value, stats);
+            break;
+        case ASTNodeType::AST_ASSIGNMENT:
+            count_ast_nodes(node->data.assignment.value, stats);
+            break;
+        case ASTNodeType::AST_RETURN:
+            count_ast_nodes(node->data.return_value, stats);
+            break;
+        case ASTNodeType::AST_SEQUENCE:
+            count_ast_nodes(node->data.sequence.first, stats);
+            count_ast_nodes(node->data.sequence.second, stats);
+            break;
+        case ASTNodeType::AST_WHILE:
+            count_ast_nodes(node->data.while_loop.condition, stats);
+            count_ast_nodes(node->data.while_loop.body, stats);
+            break;
+        case ASTNodeType::AST_FOR:
+        case ASTNodeType::AST_PARALLEL_FOR:
+            count_ast_nodes(node->data.for_loop.init, stats);
+            count_ast_nodes(node->data.for_loop.condition, stats);
+            count_ast_nodes(node->data.for_loop.increment, stats);
+            count_ast_nodes(node->data.for_loop.body, stats);
+            break;
+        case ASTNodeType::AST_IF:
+            count_ast_nodes(node->data.if_stmt.condition, stats);
+            count_ast_nodes(node->data.if_stmt.then_branch, stats);
+            count_ast_nodes(node->data.if_stmt.else_branch, stats);
+            break;
+        case ASTNodeType::AST_SWITCH:
+            count_ast_nodes(node->data.switch_stmt.value, stats);
+            for (SwitchArm *arm = node->data.switch_stmt.arms; arm; arm = arm->next) {
+                count_ast_nodes(arm->body, stats);
+            }
+            break;
+        case ASTNodeType::AST_PRINT:
+            count_ast_nodes(node->data.print_value, stats);
+            break;
+        case ASTNodeType::AST_FUNCTION_DEF:
+            count_ast_nodes(node->data.function_def.body, stats);
+            break;
+        case ASTNodeType::AST_FUNCTION_CALL:
+            for (ArgList *arg = node->data.function_call.args; arg; arg = arg->next) {
+                count_ast_nodes(arg->expr, stats);
+            }
+            break;
+        case ASTNodeType::AST_GLOBAL_VAR:
+            count_ast_nodes(node->data.global_var.value, stats);
+            break;
+        default:
+            break;
+    }
+}
+
+IRCounts count_ir(const llvm::Module &module) {
+    IRCounts counts;
+    for (const auto &func : module) {
+        if (func.isDeclaration()) continue;
+        counts.functions++;
+        for (const auto &block : func) {
+            counts.basic_blocks++;
+            for (const auto &inst : block) {
+                counts.instructions++;
+                if (llvm::isa<llvm::AllocaInst>(inst)) {
+                    counts.allocas++;
+                } else if (llvm::isa<llvm::PHINode>(inst)) {
+                    counts.phis++;
+                } else if (llvm::isa<llvm::LoadInst>(inst)) {
+                    counts.loads++;
+                } else if (llvm::isa<llvm::StoreInst>(inst)) {
+                    counts.stores++;
+                }
+            }
+        }
+    }
+    return counts;
+}
+
+static long count_instructions(const llvm::Module &module) {
+    long count = 0;
+    for (const auto &func : module) {
+        count += func.getInstructionCount();
+    }
+    return count;
+}
+
+// Pass managers and adaptors only wrap other passes; counting them too
+// would attribute their children's work twice
+static bool is_wrapper_pass(llvm::StringRef name) {
+    return name.contains("PassManager") || name.contains("Adaptor") ||
+           name.contains("Wrapper") || name.contains("Repeated");
+}
+
+void register_pass_stats(llvm::PassInstrumentationCallbacks &callbacks,
+                         const llvm::Module &module, CompileStats &stats) {
+    auto pending = std::make_shared<std::vector<long>>();
+
+    callbacks.registerBeforeNonSkippedPassCallback(
+        [&module, pending](llvm::StringRef name, llvm::Any) {
+            if (is_wrapper_pass(name)) return;
+            pending->push_back(count_instructions(module));
+        });
+
+    auto after = [&module, &stats, pending](llvm::StringRef name) {
+        if (is_wrapper_pass(name) || pending->empty()) return;
+        long before = pending->back();
+        pending->pop_back();
+
+        PassStats &pass = stats.passes[name.str()];
+        pass.runs++;
+        pass.instructions_removed += before - count_instructions(module);
+    };
+
+    callbacks.registerAfterPassCallback(
+        [after](llvm::StringRef name, llvm::Any, const llvm::PreservedAnalyses &) {
+            after(name);
+        });
+    callbacks.registerAfterPassInvalidatedCallback(
+        [after](llvm::StringRef name, const llvm::PreservedAnalyses &) {
+            after(name);
+        });
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  // Bytes on macOS
+#else
+    return usage.ru_maxrss;         // Kilobytes on Linux
+#endif
+}
+
+void record_phase(CompileStats &stats, const std::string &name,
+                  std::chrono::steady_clock::time_point &start) {
+    auto now = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - start).count();
+    stats.phases.push_back({name, ms, peak_rss_kb()});
+    start = now;
+}
+
+static std::shared_mutex statistics_mutex;
+
+std::unique_lock<std::shared_mutex> exclusive_statistics() {
+    return std::unique_lock<std::shared_mutex>(statistics_mutex);
+}
+
+std::shared_lock<std::shared_mutex> shared_statistics() {
+    return std::shared_lock<std::shared_mutex>(statistics_mutex);
+}
+
+void enable_llvm_statistics() {
+    llvm::EnableStatistics(false);
+    llvm::ResetStatistics();
+}
+
+void collect_llvm_statistics(CompileStats &stats) {
+    if (!llvm::AreStatisticsEnabled()) return;
+
+    for (const auto &[name, value] : llvm::GetStatistics()) {
+        stats.llvm_statistics.emplace_back(name.str(), value);
+    }
+}
+
+static std::string string_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static std::string string_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    va_list measure;
+    va_copy(measure, args);
+    int length = vsnprintf(nullptr, 0, fmt, measure);
+    va_end(measure);
+    std::string out(length > 0 ? length : 0, '\0');
+    if (length > 0) {
+        vsnprintf(out.data(), out.size() + 1, fmt, args);
+    }
+    va_end(args);
+    return out;
+}
+
+static std::string json_escape(const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+std::string format_stats_table(const CompileStats &stats) {
+    std::string out = "===== 3cc statistics =====\n";
+
+    long total_nodes = 0;
+    out += "\nAST nodes\n";
+    for (const auto &[type, count] : stats.ast_nodes) {
+        out += string_printf("  %-24s %10ld\n", type.c_str(), count);
+        total_nodes += count;
+    }
+    out += string_printf("  %-24s %10ld\n", "total", total_nodes);
+
+    const IRCounts &gen = stats.ir_generated;
+    const IRCounts &opt = stats.ir_optimized;
+    out += string_printf("\n%-26s %10s %10s\n", "IR", "generated", "optimized");
+    out += string_printf("  %-24s %10ld %10ld\n", "functions", gen.functions, opt.functions);
+    out += string_printf("  %-24s %10ld %10ld\n", "basic blocks", gen.basic_blocks, opt.basic_blocks);
+    out += string_printf("  %-24s %10ld %10ld\n", "instructions", gen.instructions, opt.instructions);
+    out += string_printf("  %-24s %10ld %10ld\n", "allocas", gen.allocas, opt.allocas);
+    out += string_printf("  %-24s %10ld %10ld\n", "phis", gen.phis, opt.phis);
+    out += string_printf("  %-24s %10ld %10ld\n", "loads", gen.loads, opt.loads);
+    out += string_printf("  %-24s %10ld %10ld\n", "stores", gen.stores, opt.stores);
+
+    if (!stats.passes.empty()) {
+        out += string_printf("\n%-42s %6s %10s\n", "Passes", "runs", "removed");
+        for (const auto &[name, pass] : stats.passes) {
+            out += string_printf("  %-40s %6ld %10ld\n", name.c_str(), pass.runs, pass.instructions_removed);
+        }
+    }
+
+    if (!stats.memoized.empty()) {
+        out += "\nMemoized functions\n";
+        for (const auto &name : stats.memoized) {
+            out += "  " + name + "\n";
+        }
+    }
+
+    if (stats.functions_skipped > 0) {
+        out += string_printf("\nUnreachable functions skipped: %ld\n", stats.functions_skipped);
+    }
+
+    out += string_printf("\n%-26s %10s %22s\n", "Phases", "time (ms)", "process peak RSS (KB)");
+    for (const auto &phase : stats.phases) {
+        out += string_printf("  %-24s %10.3f %22ld\n", phase.name.c_str(), phase.milliseconds, phase.peak_rss_kb);
+    }
+
+    if (!stats.llvm_statistics.empty()) {
+        out += "\nLLVM statistics\n";
+        for (const auto &[name, value] : stats.llvm_statistics) {
+            out += string_printf("  %-40s %10llu\n", name.c_str(), static_cast<unsigned long long>(value));
+        }
+    }
+
+    return out;
+}
+
+static std::string format_ir_counts_json(const IRCounts &counts) {
+    return string_printf("{\"functions\": %ld, \"basic_blocks\": %ld, \"instructions\": %ld, "
+                  "\"allocas\": %ld, \"phis\": %ld, \"loads\": %ld, \"stores\": %ld}",
+                  counts.functions, counts.basic_blocks, counts.instructions,
+                  counts.allocas, counts.phis, counts.loads, counts.stores);
+}
+
+std::string format_stats_json(const CompileStats &stats) {
+    std::string out = "{\n  \"ast_nodes\": {";
+    const char *sep = "";
+    for (const auto &[type, count] : stats.ast_nodes) {
+        out += string_printf("%s\"%s\": %ld", sep, type.c_str(), count);
+        sep = ", ";
+    }
+    out += "},\n";
+
+    out += "  \"ir_generated\": " + format_ir_counts_json(stats.ir_generated) + ",\n";
+    out += "  \"ir_optimized\": " + format_ir_counts_json(stats.ir_optimized) + ",\n";
+
+    out += "  \"passes\": {";
+    sep = "";
+    for (const auto &[name, pass] : stats.passes) {
+        out += sep;
+        out += "\"" + json_escape(name) + "\": ";
+        out += string_printf("{\"runs\": %ld, \"instructions_removed\": %ld}", pass.runs, pass.instructions_removed);
+        sep = ", ";
+    }
+    out += "},\n";
+
+    out += "  \"phases\": [";
+    sep = "";
+    for (const auto &phase : stats.phases) {
+        out += string_printf("%s{\"name\": \"%s\", \"ms\": %.3f, \"process_peak_rss_kb\": %ld}",
+                      sep, phase.name.c_str(), phase.milliseconds, phase.peak_rss_kb);
+        sep = ", ";
+    }
+    out += "],\n";
+
+    out += "  \"memoized\": [";
+    sep = "";
+    for (const auto &name : stats.memoized) {
+        out += sep;
+        out += "\"" + json_escape(name) + "\"";
+        sep = ", ";
+    }
+    out += "],\n";
+
+    out += string_printf("  \"functions_skipped\": %ld,\n", stats.functions_skipped);
+
+    out += "  \"llvm_statistics\": {";
+    sep = "";
+    for (const auto &[name, value] : stats.llvm_statistics) {
+        out += sep;
+        out += "\"" + json_escape(name) + "\": ";
+        out += string_printf("%llu", static_cast<unsigned long long>(value));
+        sep = ", ";
+    }
+    out += "}\n}\n";
+
+    return out;
+}
@@ -0,0 +1,81 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "ast.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class Module;
+class PassInstrumentationCallbacks;
+}
+
+// Instruction mix of a module at one point in the pipeline
+struct IRCounts {
+    long functions = 0;
+    long basic_blocks = 0;
+    long instructions = 0;
+    long allocas = 0;
+    long phis = 0;
+    long loads = 0;
+    long stores = 0;
+};
+
+// Aggregated effect of one optimization pass over all of its runs
+struct PassStats {
+    long runs = 0;
+    long instructions_removed = 0;  // Negative when the pass adds code
+};
+
+struct PhaseStats {
+    std::string name;
+    double milliseconds;
+    long peak_rss_kb;   // Peak resident set size of the whole process so far,
+                        // not only of this compile
+};
+
+struct CompileStats {
+    std::map<std::string, long> ast_nodes;       // Keyed by ASTNodeType name
+    IRCounts ir_generated;                       // As emitted by CodeGenerator
+    IRCounts ir_optimized;                       // After optimize_module
+    std::map<std::string, PassStats> passes;     // Keyed by pass name
+    std::vector<PhaseStats> phases;
+    std::vector<std::string> memoized;           // Functions given a result cache
+    long functions_skipped = 0;                  // Unreachable, not generated
+    std::vector<std::pair<std::string, uint64_t>> llvm_statistics;
+};
+
+void count_ast_nodes(ASTNode *node, CompileStats &stats);
+IRCounts count_ir(const llvm::Module &module);
+
+// Record how many instructions each pass run removes from module.
+// The callbacks must outlive the pipeline they are attached to.
+void register_pass_stats(llvm::PassInstrumentationCallbacks &callbacks,
+                         const llvm::Module &module, CompileStats &stats);
+
+// Close the phase that began at start, and start the next one
+void record_phase(CompileStats &stats, const std::string &name,
+                  std::chrono::steady_clock::time_point &start);
+
+// Snapshot LLVM's Statistic counters. These are process-wide and only
+// populated when the LLVM build supports statistics (assertions enabled
+// or LLVM_FORCE_ENABLE_STATS). A compile that collects them holds
+// exclusive_statistics() from before enable_llvm_statistics() zeroes them
+// until it has collected them, and every other compile holds
+// shared_statistics(), so that the counters are those of one compile.
+std::unique_lock<std::shared_mutex> exclusive_statistics();
+std::shared_lock<std::shared_mutex> shared_statistics();
+void enable_llvm_statistics();
+void collect_llvm_statistics(CompileStats &stats);
+
+std::string format_stats_table(const CompileStats &stats);
+std::string format_stats_json(const CompileStats &stats);
+
+#endif /* STATS_H */
@@ -1,10 +1,13 @@
 #!/bin/bash
 
+# Extra 3cc options for assert and assert_output
+FLAGS=""
+
 assert() {
   expected="$1"
   input="$2"
 
-  ../build/3cc "$input" tmp.o > /dev/null 2>&1
+  ../build/3cc $FLAGS "$input" tmp.o > /dev/null 2>&1
   if [ $? -ne 0 ]; then
     echo "Compilation failed for: $input ❌"
     exit 1
@@ -26,7 +29,7 @@ assert_output() {
   expected="$1"
   input="$2"
 
-  ../build/3cc "$input" tmp.o > /dev/null 2>&1
+  ../build/3cc $FLAGS "$input" tmp.o > /dev/null 2>&1
   if [ $? -ne 0 ]; then
     echo "Compilation failed for: $input ❌"
     exit 1
@@ -43,6 +46,62 @@ assert_output() {
   fi
 }
 
+assert_error() {
+  expected="$1"
+  input="$2"
+
+  actual=$(../build/3cc $FLAGS "$input" tmp.o 2>&1 > /dev/null)
+  if [ $? -eq 0 ]; then
+    echo "Compilation succeeded for: $input, but expected \"$expected\" ❌"
+    exit 1
+  fi
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => \"$actual\""
+  else
+    echo "$input => \"$actual\" received, but expected \"$expected\" ❌"
+    exit 1
+  fi
+}
+
+assert_exe() {
+  expected="$1"
+  expected_output="$2"
+  input="$3"
+
+  ../build/3cc -o tmp "$input" > /dev/null 2>&1
+  if [ $? -ne 0 ]; then
+    echo "Linking failed for: $input ❌"
+    exit 1
+  fi
+
+  actual_output=$(./tmp)
+  actual="$?"
+
+  if [ "$actual" = "$expected" ] && [ "$actual_output" = "$expected_output" ]; then
+    echo "-o $input => $actual \"$actual_output\""
+  else
+    echo "-o $input => $actual \"$actual_output\" received, but expected $expected \"$expected_output\" ❌"
+    exit 1
+  fi
+}
+
+assert_tiered() {
+  expected="$1"
+  expected_output="$2"
+  input="$3"
+
+  actual_output=$(../build/3cc --tiered "$input" 2> /dev/null)
+  actual="$?"
+
+  if [ "$actual" = "$expected" ] && [ "$actual_output" = "$expected_output" ]; then
+    echo "--tiered $input => $actual \"$actual_output\""
+  else
+    echo "--tiered $input => $actual \"$actual_output\" received, but expected $expected \"$expected_output\" ❌"
+    exit 1
+  fi
+}
+
 # Change to test directory
 cd "$(dirname "$0")"
 
@@ -267,6 +326,353 @@ assert 100 "main() { x = 5; y = 3; if (x * y > 10) { return 100; } else { return
 assert 200 "main() { x = 5; y = 2; if (x * y > 10) { return 100; } else { return 200; } }"
 assert 1 "main() { x = 10; y = 5; z = 2; if (x > y + z) { return 1; } return 0; }"
 
+# Variables merged across branches and loops, and code after return
+assert 3 "main() { x = 1; if (x > 0) { y = 3; } return y; }"
+assert 0 "main() { return y; }"
+assert 7 "f(n) { while (1) { if (n > 5) { return n; } n = n + 1; } return 0; } main() { return f(2) + 1; }"
+assert 9 "main() { x = 4; for (i = 0; i < 3; i = i + 1) { if (i == 1) { x = x + 5; } else { x = x; } } return x; }"
+assert 2 "main() { return 2; x = 5; return x; }"
+
+# Switch: grouped labels, negative values, default, no fallthrough
+switch="kind(c) { switch (c) { case 0: return 10; case 1: case 2: print(c); return 20; case -1: return 30; default: return 0; } return 0; } main() { for (i = 0 - 2; i < 4; i = i + 1) { print(kind(i)); } x = 5; switch (x) { case 5: x = x + 1; case 6: x = x + 100; } return x; }"
+for level in -O0 -O2; do
+  FLAGS="$level"
+  assert_output "0
+30
+10
+1
+20
+2
+20
+0" "$switch"
+  assert 6 "$switch"
+done
+assert_tiered 6 "0
+30
+10
+1
+20
+2
+20
+0" "$switch"
+FLAGS="-O1 --remarks"
+chain="f(x) { if (x == 1) { return 10; } else { if (2 == x) { return 20; } else { if (x == 3) { return 30; } else { return 40; } } } } main() { s = 0; for (i = 0; i < 5; i = i + 1) { s = s + f(i); } return s; }"
+assert 140 "$chain"
+if ../build/3cc $FLAGS "$chain" tmp.o 2>&1 | grep -q "remark: if-else chain on x in f: 3 compares made a switch" &&
+   grep -q "switch i32" tmp.ll; then
+  echo "if-else chain => switch"
+else
+  echo "if-else chain: not turned into a switch ❌"
+  exit 1
+fi
+assert_error "Error: duplicate case 1 in switch" "main() { switch (1) { case 1: return 1; case 1: return 2; } return 0; }"
+assert_error "Error: a switch can only have one default" "main() { switch (1) { default: return 1; case 2: default: return 2; } return 0; }"
+FLAGS=""
+
+# Logical and conditional operators: precedence, 0/1 results, and the
+# right operand only evaluated when needed (side prints when it is)
+logic="side(x) { print(x); return x; } clamp(x) { return x < 0 ? 0 : x > 9 ? 9 : x; } safe(x, y) { return y != 0 && x / y > 2; } main() { print(0 && side(1)); print(1 || side(2)); print(2 && side(3)); print(0 || side(0)); print(1 ? side(4) : side(5)); print(safe(9, 0) + safe(9, 3) * 10 + safe(9, 2) * 100); print(clamp(0 - 5) + clamp(5) * 10 + clamp(50) * 100); return !0 + !7 * 2 + (1 < 2 && 3 > 4 || 5 == 5) * 4; }"
+for level in -O0 -O2; do
+  FLAGS="$level"
+  assert_output "0
+1
+3
+1
+0
+0
+4
+4
+110
+950" "$logic"
+  assert 5 "$logic"
+done
+assert_tiered 5 "0
+1
+3
+1
+0
+0
+4
+4
+110
+950" "$logic"
+FLAGS=""
+assert 1 "main() { x = 3; y = 0 - 2; return x > 0 && y < 0; }"
+assert 7 "main() { return 0 ? 1 : 0 ? 2 : 7; }"
+assert 3 "g = 1 && 2; h = 0 || 0; k = 0 && 1 / 0; main() { return g + h + (k ? 5 : 2); }"
+if ../build/3cc -O0 "clamp(x) { return x < 0 ? 0 : x; } both(x, y) { return x > 0 && y > 0; } main() { return clamp(both(1, 2)); }" tmp.o > /dev/null &&
+   grep -q "select i1" tmp.ll && grep -q "and i1" tmp.ll && ! grep -q "br i1" tmp.ll; then
+  echo "cheap && and ?: => no branches"
+else
+  echo "cheap && and ?: generated branches ❌"
+  exit 1
+fi
+
+# Automatic memoization of pure recursive functions (at -O0, where calls
+# with constant arguments are not evaluated at compile time)
+FLAGS="--auto-memoize -O0"
+assert 55 "fib(n) { if (n < 2) { return n; } return fib(n-1) + fib(n-2); } main() { return fib(10); }"
+assert_output "102334155" "fib(n) { if (n < 2) { return n; } return fib(n-1) + fib(n-2); } main() { print(fib(40)); return 0; }"
+assert 6 "g = 2; c(n, k) { if (k == 0) { return 1; } if (k == n) { return 1; } return c(n-1, k-1) + c(n-1, k); } main() { return c(4, g); }"
+assert_output "3
+2
+1
+0" "down(n) { print(n); if (n > 0) { return down(n-1); } return 0; } main() { return down(3); }"
+assert 4 "count = 0; f(n) { count = count + 1; if (n > 0) { return f(n-1); } return count; } main() { f(1); return f(1); }"
+FLAGS=""
+
+# Compile-time evaluation of pure calls and global initializers
+assert 25 "fib(n) { if (n < 2) { return n; } return fib(n-1) + fib(n-2); } main() { return fib(25) - 75000; }"
+assert 50 "sq(x) { return x * x; } g = sq(7) + 1; main() { return g; }"
+assert 11 "a = 5; b = a * 2 + 1; main() { return b; }"
+assert 3 "g = 0 - 5; main() { return g + 8; }"
+assert 4 "d(n) { return 8 / n; } main() { x = 2; if (x == 0) { return d(0); } return d(x); }"
+assert 1 "f(n) { while (n > 0) { n = n + 1; } return n; } main() { if (f(0) == 0) { return 1; } return f(1); }"
+assert_error "Error: initializer of global g is not a compile-time constant" "c = 0; inc() { c = c + 1; return c; } g = inc(); main() { return g; }"
+deep="down(n) { if (n > 0) { return down(n - 1); } return 0; }"
+assert 7 "$deep main() { return down(5000) + 7; }"
+if ../build/3cc --remarks "$deep main() { return down(5000); }" tmp.o 2>&1 |
+   grep -q "remark: not evaluated at compile time: down(5000): call depth limit reached"; then
+  echo "down(5000) => call depth limit remark"
+else
+  echo "down(5000): no call depth limit remark ❌"
+  exit 1
+fi
+assert_error "Error: initializer of global g is not a compile-time constant" "$deep g = down(5000); main() { return g; }"
+FLAGS="-O0"
+assert 50 "sq(x) { return x * x; } g = sq(7) + 1; main() { return g; }"
+FLAGS=""
+
+# Read-only globals become constants, single-function globals locals
+assert 45 "limit = 10; count = 0; main() { for (i = 0; i < limit; i = i + 1) { count = count + i; } return count; }"
+assert 15 "acc = 3; add(x) { acc = x; acc = acc + 10; return acc; } main() { add(1); return add(5); }"
+assert 2 "c = 0; f() { c = c + 1; return c; } main() { f(); return f(); }"
+assert 6 "t = 0; rec(n) { t = t + n; if (n > 0) { return rec(n-1); } return t; } main() { return rec(3); }"
+assert 7 "g = 7; main() { x = g; g = 1; return x; }"
+
+# Performance hints: function qualifiers and branch hints
+assert 29 "inline hot sq(x) { return x * x; } cold noinline err(x) { print(x); return 1; } main() { i = 0; s = 0; while likely(i < 10) { s = s + sq(i); i = i + 1; } if unlikely(s > 1000) { return err(s); } else { s = s - 256; } return s; }"
+assert 4 "noinline f(x) { if likely(x > 0) { return x; } return 0; } main() { return f(4); }"
+assert_error "Error: a function cannot be both hot and cold" "hot cold f() { return 1; } main() { return f(); }"
+assert 10 "hot = 3; likely(x) { return x + 1; } cold inline(unlikely) { return unlikely * hot; } main() { cold = inline(2); return likely(cold) + hot; }"
+assert_error "Error: unknown function qualifier fast" "fast f() { return 1; } main() { return f(); }"
+assert_error "Error: unknown branch hint maybe (expected likely or unlikely)" "main() { if maybe(1) { return 1; } return 0; }"
+../build/3cc -O0 "cold f(x) { return x; } g(x) { if unlikely(x > 5) { return f(x); } return 0; } main() { return g(3); }" tmp.o > /dev/null
+if grep -q "!prof" tmp.ll && grep -q "cold" tmp.ll; then
+  echo "cold, unlikely => attribute and branch weights in IR"
+else
+  echo "cold, unlikely: no attribute or branch weights in IR ❌"
+  exit 1
+fi
+
+# Function instrumentation with the profiling runtime
+../build/3cc -O0 --instrument-functions "fib(n) { if (n < 2) { return n; } return fib(n-1) + fib(n-2); } main() { return fib(10); }" tmp.o > /dev/null
+clang -rdynamic -o tmp tmp.o ../build/lib3cc_rt.a -lpthread -ldl
+report=$(./tmp 2>&1)
+collapsed=$(THREECC_PROFILE_FORMAT=collapsed ./tmp 2>&1)
+if echo "$report" | grep -Eq "^fib +177 " && echo "$report" | grep -Eq "^main +1 " &&
+   echo "$collapsed" | grep -q "^main;fib;fib "; then
+  echo "--instrument-functions => fib called 177 times"
+else
+  echo "--instrument-functions: unexpected profile \"$report\" ❌"
+  exit 1
+fi
+../build/3cc -O0 --instrument-functions "sq(x) { return x * x; } main() { s = 0; parallel for (i = 0; i < 1000; i = i + 1) reduce(+: s) { s = s + sq(i); } print(s); return 0; }" tmp.o > /dev/null
+clang -rdynamic -o tmp tmp.o ../build/lib3cc_rt.a -lpthread -ldl
+report=$(THREECC_NUM_THREADS=4 ./tmp 2>&1)
+if echo "$report" | grep -Eq "^sq +1000 "; then
+  echo "--instrument-functions, parallel for => sq called 1000 times over all threads"
+else
+  echo "--instrument-functions, parallel for: unexpected profile \"$report\" ❌"
+  exit 1
+fi
+FLAGS="--instrument-functions -o tmp"
+assert_error "--instrument-functions needs the profiling runtime: write an object file and link it with lib3cc_rt.a instead of using -o" "main() { return 0; }"
+FLAGS=""
+
+# Parallel for with reductions, on the thread pool of lib3cc_rt
+parallel="main() { s = 0; p = 1; k = 3; parallel for (i = 0; i < 1000; i = i + 1) reduce(+: s) reduce(*: p) { s = s + i * k; if (i < 5) { p = p * (i + 1); } k = 0; } print(s); print(p); print(i); print(k); return 0; }"
+for level in -O0 -O2; do
+  ../build/3cc $level "$parallel" tmp.o > /dev/null
+  clang -o tmp tmp.o ../build/lib3cc_rt.a -lpthread -ldl
+  for threads in 1 4; do
+    actual=$(THREECC_NUM_THREADS=$threads ./tmp | tr '\n' ' ')
+    if [ "$actual" = "1498500 120 1000 3 " ]; then
+      echo "parallel for $level, $threads threads => \"$actual\""
+    else
+      echo "parallel for $level, $threads threads => \"$actual\" received, but expected \"1498500 120 1000 3 \" ❌"
+      exit 1
+    fi
+  done
+done
+assert_tiered 0 "1498500
+120
+1000
+3" "$parallel"
+assert_error "Error: parallel for in main: the body assigns global g" "g = 0; main() { parallel for (i = 0; i < 10; i = i + 1) { g = i; } return g; }"
+assert_error "Error: parallel for in main: the reduction variable s can only be updated, as s = s + ..." "main() { s = 0; parallel for (i = 0; i < 10; i = i + 1) reduce(+: s) { print(s); } return s; }"
+
+# Functions unreachable from main are not generated (unless exported)
+assert 3 "dead() { return missing(); } main() { return 3; }"
+callgraph=$(../build/3cc --print-callgraph "leaf(x) { print(x); return x; } unused() { return leaf(1); } main() { return leaf(2); }" tmp.o)
+if echo "$callgraph" | grep -qx "main -> leaf" && echo "$callgraph" | grep -qx "unused -> leaf (unreachable)"; then
+  echo "--print-callgraph => main -> leaf, unused -> leaf (unreachable)"
+else
+  echo "--print-callgraph: unexpected output \"$callgraph\" ❌"
+  exit 1
+fi
+../build/3cc --export=helper "helper(x) { return x + 1; } main() { return 0; }" tmp.o > /dev/null
+if grep -q "define i32 @helper" tmp.ll; then
+  echo "--export=helper => helper generated"
+else
+  echo "--export=helper: helper was not generated ❌"
+  exit 1
+fi
+
+# Several targets from one compile: one object per triple
+host=$(clang -dumpmachine)
+if ! ../build/3cc "--target=$host,aarch64-linux-gnu" "main() { return 21 * 2; }" tmp.o > /dev/null 2>&1 ||
+   [ ! -s "tmp.aarch64-linux-gnu.o" ]; then
+  echo "Multi-target compilation failed ❌"
+  exit 1
+fi
+clang -o tmp "tmp.$host.o"
+./tmp
+if [ "$?" = "42" ]; then
+  echo "--target=$host,aarch64-linux-gnu => 42"
+else
+  echo "--target=$host,aarch64-linux-gnu: wrong exit code ❌"
+  exit 1
+fi
+rm -f tmp.*-*.o tmp.*-*.ll
+
+# Hot functions cloned per x86-64 level, behind ifuncs (x86-64 hosts only)
+multiversion="hot dot(n) { s = 0; for (i = 0; i < n; i = i + 1) { s = s + i * i; } return s; } hot fact(n) { if (n < 2) { return 1; } return n * fact(n - 1); } main() { t = 0; for (k = 0; k < 3; k = k + 1) { t = t + dot(1000 + k) + fact(5 + k); } print(t); return 0; }"
+case "$host" in
+x86_64*linux*)
+  FLAGS="-O2 --multiversion=x86-64-v2,x86-64-v3,x86-64-v4"
+  assert_output "1001508381" "$multiversion"
+  if grep -q "@dot = ifunc" tmp.ll && grep -q "@fact.x86_64_v4" tmp.ll; then
+    echo "--multiversion => dot and fact dispatched through ifuncs"
+  else
+    echo "--multiversion: no ifuncs in the IR ❌"
+    exit 1
+  fi
+  FLAGS="--multiversion=x86-64-v5"
+  assert_error "Unknown x86-64 level: x86-64-v5 (expected x86-64-v2, x86-64-v3 or x86-64-v4)" "$multiversion"
+  ;;
+esac
+FLAGS="--target=aarch64-linux-gnu --multiversion=x86-64-v3"
+assert_error "Multiversioning needs an x86-64 ELF target, for its ifuncs: aarch64-linux-gnu" "$multiversion"
+FLAGS="--target=bogus-unknown-none"
+rm -f tmp.o
+assert_error "Target not supported by this build of 3cc: bogus-unknown-none" "main() { return 0; }"
+if [ -e tmp.o ]; then
+  echo "--target=bogus-unknown-none: an object was written anyway ❌"
+  exit 1
+fi
+FLAGS=""
+
+# Streaming: each function is generated as soon as it is parsed
+FLAGS="--stream"
+assert 42 "main() { return twice(21); } twice(x) { return x * 2; }"
+assert_output "10" "g = 4; h = g + 1; main() { print(twice(h)); return 0; } twice(x) { return x * 2; }"
+assert_error "Function f takes 2 arguments, but is called with 1" "main() { return f(1); } f(a, b) { return a; }"
+assert_error "Unknown function referenced: g2" "main() { return g2(); }"
+assert_error "Error: global g is declared after main, which uses it; streaming needs globals declared before their users" "main() { return g + 1; } g = 4;"
+assert_error "Error: parallel for in main: the body calls bump, which assigns global c" "c = 0; main() { s = 0; parallel for (i = 0; i < 10; i = i + 1) reduce(+: s) { s = s + bump(i); } return s; } bump(x) { c = x; return x; }"
+assert_error "Error: parallel for in main: the condition must be i < bound or i <= bound, with a bound that does not use i" "main() { n = 5; parallel for (i = 0; n; i = i + 1) { print(i); } return 0; }"
+assert_error "Error: parallel for in main: the increment must be i = i + a positive constant" "f(x) { return x + 1; } main() { parallel for (i = 0; i < 5; i = f(i)) { print(i); } return 0; }"
+FLAGS=""
+
+# Adaptive optimization: a tier per function, from its loops, calls and size
+adaptive="setup(x) { print(x); return x * 3; } sq(x) { return x * x; } cold report(s) { print(s); return 0; } main() { s = setup(2); for (i = 0; i < 100; i = i + 1) { s = s + sq(i); } return report(s); }"
+FLAGS="-O2 --adaptive-opt"
+assert_output "2
+328356" "$adaptive"
+if grep -Eq "define i32 @setup\(i32 %x\) .*#" tmp.ll && grep -q "noinline optnone" tmp.ll &&
+   ! grep -q "call i32 @sq" tmp.ll; then
+  echo "--adaptive-opt => setup and report optnone, sq inlined into main"
+else
+  echo "--adaptive-opt: unexpected tiers in the IR ❌"
+  exit 1
+fi
+FLAGS="-O2 --opt-budget-ms=0.01"
+assert_output "2
+328356" "$adaptive"
+FLAGS="--stream --adaptive-opt"
+assert_error "Error: adaptive optimization needs the whole call graph, which streaming does not keep" "main() { return 0; }"
+FLAGS=""
+
+# Size optimization: optsize/minsize, a section per function, one "%d\n"
+sized="twice(x) { return x + x; } main() { for (i = 0 - 1; i < 3; i = i + 1) { print(twice(i)); } print(0 - 2147483647 - 1); return 5; }"
+for level in -Os -Oz; do
+  FLAGS="$level"
+  assert_output "-2
+0
+2
+4
+-2147483648" "$sized"
+  assert 5 "$sized"
+done
+if grep -q "minsize" tmp.ll && readelf -S tmp.o | grep -q "\.text\.main"; then
+  echo "-Oz => minsize functions in sections of their own"
+else
+  echo "-Oz: functions not marked minsize or not in their own sections ❌"
+  exit 1
+fi
+../build/3cc -O0 "main() { print(1); print(2); print(3); return 0; }" tmp.o > /dev/null
+if [ "$(grep -c '^@print.format' tmp.ll)" = 1 ]; then
+  echo "three prints => one format string"
+else
+  echo "three prints: not one shared format string ❌"
+  exit 1
+fi
+FLAGS=""
+
+# Cost report: cycles per call and per loop iteration, for each function
+nested="main() { for (i = 0; i < 10; i = i + 1) { for (j = 0; j < i; j = j + 1) { print(i * j); } } return 0; }"
+report=$(../build/3cc -O1 --cost-report "$nested" tmp.o 2>&1 > /dev/null)
+if echo "$report" | grep -q "^main " && echo "$report" | grep -q "^    loop "; then
+  echo "--cost-report => main and its nested loops"
+else
+  echo "--cost-report: main or its nested loops missing ❌"
+  echo "$report"
+  exit 1
+fi
+if ../build/3cc -O1 --cost-report=json "$nested" tmp.o 2>&1 > /dev/null | grep -q '"issue_width": [1-9]'; then
+  echo "--cost-report=json => issue width of the CPU"
+else
+  echo "--cost-report=json: no issue width ❌"
+  exit 1
+fi
+
+# Tiered execution: interpreted at first, hot functions switch to native code
+assert_tiered 42 "" "main() { return 42; }"
+assert_tiered 7 "2178309" "fib(n) { if (n < 2) { return n; } return fib(n-1) + fib(n-2); } main() { print(fib(32)); return 7; }"
+assert_tiered 0 "300000" "g = 0; inc(n) { g = g + n; return g; } main() { for (i = 0; i < 100000; i = i + 1) { inc(3); } print(g); return 0; }"
+assert_tiered 3 "6" "add3(a, b, c) { return a + b + c; } main() { x = add3(1, 2, 3); print(x); return add3(0, 1, 2); }"
+
+# Built-in linking (only when 3cc was built with lld)
+if ../build/3cc -o tmp "main() { return 0; }" > /dev/null 2>&1; then
+  assert_exe 42 "" "main() { return 42; }"
+  assert_exe 0 "25" "main() { x=5; print(x*x); return 0; }"
+  assert_exe 0 "-7
+2147483647" "main() { print(0-7); print(2147483647); return 0; }"
+  assert_exe 13 "0
+1
+2" "fib(n) { if (n < 2) { return n; } return fib(n-1) + fib(n-2); } main() { for (i=0; i < 3; i=i+1) { print(i); } return fib(7); }"
+  # -Oz links the unbuffered runtime
+  if ../build/3cc -Oz -o tmp "$sized" > /dev/null && [ "$(./tmp | tr '\n' ' ')" = "-2 0 2 4 -2147483648 " ]; then
+    echo "-Oz -o => unbuffered runtime"
+  else
+    echo "-Oz -o: wrong output ❌"
+    exit 1
+  fi
+else
+  echo "Skipping built-in linking tests (3cc was built without lld)"
+fi
+
 # Cleanup
 rm -f tmp tmp.o tmp.ll
 
@@ -0,0 +1,272 @@
+#include "lib3cc.h"
+#include "analysis.h"
+#include "bytecode.h"
+#include "codegen.h"
+#include "consteval.h"
+#include "context.h"
+#include "runtime/parallel.h"
+#include <llvm/ExecutionEngine/Orc/AbsoluteSymbols.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Compiles hot functions on a background thread and installs them in the
+// interpreter. Native code works directly on the interpreter's globals.
+class JITTier : public TierUpListener {
+private:
+    const BytecodeProgram &program;
+    GlobalVar *globals;
+    Interpreter &interpreter;
+    const TieredOptions &options;
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<bool> requested;   // Interpreter thread only
+    std::vector<bool> compiled;    // Worker thread only
+
+    // A function that became hot, with its counts read on the interpreter
+    // thread, which keeps updating them
+    struct HotFunction {
+        int function;
+        long calls;
+        long loop_iterations;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<HotFunction> queue;
+    bool stopping = false;
+    std::vector<std::string> remarks;
+    std::thread worker;
+
+    void add_remark(const std::string &remark) {
+        std::lock_guard<std::mutex> lock(mutex);
+        remarks.push_back(remark);
+    }
+
+    double elapsed_ms() const {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    void run_worker();
+    void compile(const HotFunction &hot);
+
+public:
+    JITTier(const BytecodeProgram &program, GlobalVar *globals, Interpreter &interpreter,
+            const TieredOptions &options)
+        : program(program), globals(globals), interpreter(interpreter), options(options),
+          requested(program.functions.size()), compiled(program.functions.size()) {}
+
+    bool start_jit(std::string &error);
+
+    void function_is_hot(int function) override;
+
+    // Wait for the compilation in progress, if any, and drop the rest
+    std::vector<std::string> stop();
+};
+
+bool JITTier::start_jit(std::string &error) {
+    if (!initialize_native_target()) {
+        error = "The host target is not supported by this build of 3cc";
+        return false;
+    }
+
+    auto created = llvm::orc::LLJITBuilder().create();
+    if (!created) {
+        error = llvm::toString(created.takeError());
+        return false;
+    }
+    jit = std::move(*created);
+
+    // Compiled code declares the globals (set_external_globals); resolve
+    // them to the interpreter's storage. Parallel loops call the runtime
+    // linked into this process.
+    llvm::orc::SymbolMap symbols;
+    for (size_t i = 0; i < program.global_names.size(); i++) {
+        symbols[jit->mangleAndIntern(program.global_names[i])] = llvm::orc::ExecutorSymbolDef(
+            llvm::orc::ExecutorAddr::fromPtr(&interpreter.globals[i]), llvm::JITSymbolFlags::Exported);
+    }
+    symbols[jit->mangleAndIntern("__3cc_parallel_for")] = llvm::orc::ExecutorSymbolDef(
+        llvm::orc::ExecutorAddr::fromPtr(&__3cc_parallel_for), llvm::JITSymbolFlags::Exported);
+    if (auto err = jit->getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
+        error = llvm::toString(std::move(err));
+        return false;
+    }
+
+    worker = std::thread(&JITTier::run_worker, this);
+    return true;
+}
+
+void JITTier::function_is_hot(int function) {
+    // Native calls are dispatched by arity, which limits the parameters
+    if (requested[function] || program.functions[function].param_count > MAX_NATIVE_ARGS) {
+        return;
+    }
+    requested[function] = true;
+
+    HotFunction hot = {function, interpreter.call_count(function), interpreter.loop_count(function)};
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(hot);
+    wakeup.notify_one();
+}
+
+void JITTier::run_worker() {
+    for (;;) {
+        HotFunction hot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            hot = queue.front();
+            queue.pop_front();
+        }
+        if (!compiled[hot.function]) {
+            compile(hot);
+        }
+    }
+}
+
+void JITTier::compile(const HotFunction &hot) {
+    int function = hot.function;
+
+    // Compile the function together with every callee that is not native
+    // yet, so that the hot code runs without going back to the interpreter
+    std::vector<bool> in_module(program.functions.size());
+    std::vector<int> pending = {function};
+    in_module[function] = true;
+    while (!pending.empty()) {
+        int current = pending.back();
+        pending.pop_back();
+        for (const Instruction &inst : program.functions[current].code) {
+            if (inst.op == Opcode::CALL && !compiled[inst.operand] && !in_module[inst.operand]) {
+                in_module[inst.operand] = true;
+                pending.push_back(inst.operand);
+            }
+        }
+    }
+
+    // Callees are always defined before their callers (or are the caller),
+    // so source order is a valid generation order. Functions compiled
+    // earlier are only declared; the JIT links the calls to them.
+    CodeGenerator codegen;
+    codegen.set_external_globals(true);
+    std::vector<ASTNode*> defs;
+    std::vector<int> members;
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        const BytecodeFunction &func = program.functions[i];
+        if (in_module[i]) {
+            defs.push_back(func.def);
+            members.push_back(static_cast<int>(i));
+        } else if (compiled[i]) {
+            codegen.declare_function(func.name, func.param_count);
+        }
+    }
+
+    const std::string &name = program.functions[function].name;
+    double queued_at = elapsed_ms();
+    codegen.generate_functions(defs, globals);
+    if (codegen.has_errors() || !codegen.set_target("")) {
+        add_remark("could not compile " + name + ": " + codegen.get_diagnostics().front());
+        return;
+    }
+    codegen.optimize_module(options.opt_level);
+
+    llvm::orc::ThreadSafeModule module(codegen.release_module(), codegen.release_context());
+    if (auto err = jit->addIRModule(std::move(module))) {
+        add_remark("could not compile " + name + ": " + llvm::toString(std::move(err)));
+        return;
+    }
+
+    // Looking the functions up makes the JIT compile them, here on the
+    // worker thread; then later calls from the interpreter go native
+    std::string compiled_names;
+    for (int member : members) {
+        auto address = jit->lookup(program.functions[member].name);
+        if (!address) {
+            add_remark("could not compile " + name + ": " + llvm::toString(address.takeError()));
+            return;
+        }
+        compiled[member] = true;
+        interpreter.install_native(member, address->toPtr<void *>());
+        compiled_names += " " + program.functions[member].name;
+    }
+
+    char timing[96];
+    snprintf(timing, sizeof(timing), "after %ld calls and %ld loop iterations, in %.1f ms:",
+             hot.calls, hot.loop_iterations, elapsed_ms() - queued_at);
+    add_remark("tiered up " + name + " " + timing + compiled_names);
+}
+
+std::vector<std::string> JITTier::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        wakeup.notify_one();
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+    return std::move(remarks);
+}
+
+RunResult run_tiered(const std::string &source, const TieredOptions &options) {
+    RunResult result;
+
+    CompileContext ctx;
+    if (parse_program(&ctx, source.c_str()) != 0) {
+        result.diagnostics = std::move(ctx.diagnostics);
+        return result;
+    }
+
+    // Only the global initializers: everything else runs soon enough
+    evaluate_constants(ctx.root, false, result.remarks, result.diagnostics);
+    if (!result.diagnostics.empty()) {
+        return result;
+    }
+
+    GlobalVar *globals = collect_global_vars(ctx.root);
+    check_parallel_loops(analyze_functions(ctx.root, globals), globals, result.diagnostics);
+    BytecodeProgram program;
+    if (!result.diagnostics.empty() || !compile_bytecode(ctx.root, globals, program, result.diagnostics)) {
+        global_vars_free(globals);
+        return result;
+    }
+    if (program.main_function < 0) {
+        result.diagnostics.push_back("Error: main() function is required");
+        global_vars_free(globals);
+        return result;
+    }
+
+    Interpreter interpreter(program);
+    JITTier tier(program, globals, interpreter, options);
+
+    std::string error;
+    if (tier.start_jit(error)) {
+        interpreter.set_tier_up(&tier, options.call_threshold, options.loop_threshold);
+    } else {
+        result.remarks.push_back("JIT tier unavailable, interpreting only: " + error);
+    }
+
+    int32_t exit_code = 0;
+    bool finished = interpreter.call(program.main_function, {}, exit_code);
+    fflush(stdout);
+
+    auto tier_remarks = tier.stop();
+    result.remarks.insert(result.remarks.end(), tier_remarks.begin(), tier_remarks.end());
+    global_vars_free(globals);
+
+    if (!finished) {
+        result.diagnostics.push_back("Runtime error: " + interpreter.failure_reason());
+        return result;
+    }
+    result.exit_code = exit_code;
+    result.success = true;
+    return result;
+}